@@ -2,11 +2,17 @@
 x86_64-unknown-cloudabi-cc -O2 -Wall -Werror -I../libemulator \
     -o cloudabi-emulate \
     ../libemulator/emulate.c \
+    ../libemulator/epoch.c \
     ../libemulator/futex.c \
+    ../libemulator/hostpoll.c \
+    ../libemulator/hostvdso.c \
     ../libemulator/posix.c \
+    ../libemulator/profile.c \
     ../libemulator/random.c \
+    ../libemulator/scratch.c \
     ../libemulator/signals.c \
     ../libemulator/str.c \
+    ../libemulator/symbols.c \
     ../libemulator/tidpool.c \
     ../libemulator/tls.c \
     cloudabi-emulate.c
@@ -42,12 +42,47 @@
 #include <yaml.h>
 
 #include "../libemulator/emulate.h"
+#include "../libemulator/futex.h"
+#include "../libemulator/metrics.h"
 #include "../libemulator/posix.h"
+#include "../libemulator/stats.h"
 
 #define TAG_PREFIX "tag:nuxi.nl,2015:cloudabi/"
 
 static const argdata_t *parse_object(yaml_parser_t *parser);
 
+// Arena from which all argument data is allocated.
+static argdata_arena_t *arena;
+
+// Entries of the maps and sequences that are being parsed. Nested
+// containers push their entries on top and pop them once they are
+// complete, at which point they are copied into the arena.
+static const argdata_t **scratch;
+static size_t scratch_len, scratch_space;
+
+// Allocates memory from the arena, terminating on failure.
+static void *arena_alloc(size_t len) {
+  void *p = argdata_arena_alloc(arena, len);
+  if (p == NULL) {
+    perror("Cannot allocate argument data");
+    exit(127);
+  }
+  return p;
+}
+
+// Pushes an entry of a map or sequence onto the scratch stack.
+static void scratch_push(const argdata_t *ad) {
+  if (scratch_len == scratch_space) {
+    scratch_space = scratch_space < 64 ? 64 : scratch_space * 2;
+    scratch = realloc(scratch, scratch_space * sizeof(scratch[0]));
+    if (scratch == NULL) {
+      perror("Cannot allocate argument data");
+      exit(127);
+    }
+  }
+  scratch[scratch_len++] = ad;
+}
+
 // Obtains the next event from the YAML input stream.
 static void get_event(yaml_parser_t *parser, yaml_event_t *event) {
   do {
@@ -112,7 +147,7 @@ static const argdata_t *parse_fd(yaml_event_t *event) {
   if (fstat(fd, &sb) != 0)
     exit_parse_error(event, "File descriptor %d: %s", fd, strerror(errno));
   yaml_event_delete(event);
-  return argdata_create_fd(fd);
+  return argdata_arena_create_fd(arena, fd);
 }
 
 // Parses a file, opens it and returns a file descriptor number.
@@ -147,7 +182,7 @@ static const argdata_t *parse_file(const yaml_event_t *event,
   int fd = open(path, O_RDONLY);
   if (fd < 0)
     exit_parse_error(event, "Failed to open \"%s\": %s", path, strerror(errno));
-  return argdata_create_fd(fd);
+  return argdata_arena_create_fd(arena, fd);
 }
 
 // Parses an integer value.
@@ -174,7 +209,7 @@ static const argdata_t *parse_int(yaml_event_t *event) {
     errno = 0;
     intval = strtoimax(value, &endptr, base);
     if (errno == 0 && endptr == value_end)
-      return argdata_create_int(intval);
+      return argdata_arena_create_int(arena, intval);
   }
 
   // Try unsigned integer conversion.
@@ -184,7 +219,7 @@ static const argdata_t *parse_int(yaml_event_t *event) {
     errno = 0;
     uintval = strtoumax(value, &endptr, base);
     if (errno == 0 && endptr == value_end)
-      return argdata_create_int(uintval);
+      return argdata_arena_create_int(arena, uintval);
   }
 
   // Integer value out of bounds.
@@ -193,21 +228,25 @@ static const argdata_t *parse_int(yaml_event_t *event) {
 
 // Parses a map.
 static const argdata_t *parse_map(yaml_parser_t *parser) {
-  const argdata_t **keys = NULL, **values = NULL;
-  size_t nentries = 0, space = 0;
+  size_t start = scratch_len;
   for (;;) {
     const argdata_t *ad = parse_object(parser);
     if (ad == NULL)
       break;
-    if (nentries == space) {
-      space = space < 8 ? 8 : space * 2;
-      keys = realloc(keys, space * sizeof(keys[0]));
-      values = realloc(values, space * sizeof(values[0]));
-    }
-    keys[nentries] = ad;
-    values[nentries++] = parse_object(parser);
+    scratch_push(ad);
+    scratch_push(parse_object(parser));
+  }
+
+  // Split the keys and values into separate arrays.
+  size_t nentries = (scratch_len - start) / 2;
+  const argdata_t **keys = arena_alloc(2 * nentries * sizeof(keys[0]));
+  const argdata_t **values = keys + nentries;
+  for (size_t i = 0; i < nentries; ++i) {
+    keys[i] = scratch[start + 2 * i];
+    values[i] = scratch[start + 2 * i + 1];
   }
-  return argdata_create_map(keys, values, nentries);
+  scratch_len = start;
+  return argdata_arena_create_map(arena, keys, values, nentries);
 }
 
 // Parses a null value.
@@ -218,19 +257,29 @@ static const argdata_t *parse_null(yaml_event_t *event) {
 
 // Parses a sequence.
 static const argdata_t *parse_seq(yaml_parser_t *parser) {
-  const argdata_t **entries = NULL;
-  size_t nentries = 0, space = 0;
+  size_t start = scratch_len;
   for (;;) {
     const argdata_t *ad = parse_object(parser);
     if (ad == NULL)
       break;
-    if (nentries == space) {
-      space = space < 8 ? 8 : space * 2;
-      entries = realloc(entries, space * sizeof(entries[0]));
-    }
-    entries[nentries++] = ad;
+    scratch_push(ad);
   }
-  return argdata_create_seq(entries, nentries);
+
+  size_t nentries = scratch_len - start;
+  const argdata_t **entries = arena_alloc(nentries * sizeof(entries[0]));
+  memcpy(entries, scratch + start, nentries * sizeof(entries[0]));
+  scratch_len = start;
+  return argdata_arena_create_seq(arena, entries, nentries);
+}
+
+// Parses a string. The string is copied into the arena, so that the
+// event can be released.
+static const argdata_t *parse_str(yaml_event_t *event) {
+  size_t len = event->data.scalar.length;
+  char *str = arena_alloc(len + 1);
+  memcpy(str, event->data.scalar.value, len + 1);
+  yaml_event_delete(event);
+  return argdata_arena_create_str(arena, str, len);
 }
 
 // Parses a socket, creates it and returns a file descriptor number.
@@ -336,7 +385,7 @@ static const argdata_t *parse_socket(const yaml_event_t *event,
 
   if (res != NULL)
     freeaddrinfo(res);
-  return argdata_create_fd(fd);
+  return argdata_arena_create_fd(arena, fd);
 }
 
 static const argdata_t *parse_object(yaml_parser_t *parser) {
@@ -363,8 +412,7 @@ static const argdata_t *parse_object(yaml_parser_t *parser) {
       yaml_event_delete(&event);
     case YAML_SCALAR_EVENT:
       if (tag == NULL || strcmp(tag, YAML_STR_TAG) == 0) {
-        return argdata_create_str((const char *)event.data.scalar.value,
-                                  event.data.scalar.length);
+        return parse_str(&event);
       } else if (strcmp(tag, YAML_BOOL_TAG) == 0) {
         return parse_bool(&event);
       } else if (strcmp(tag, YAML_INT_TAG) == 0) {
@@ -393,47 +441,106 @@ static const argdata_t *parse_object(yaml_parser_t *parser) {
 }
 
 static noreturn void usage(void) {
-  fprintf(stderr, "usage: cloudabi-run [-e] executable\n");
+  fprintf(stderr,
+          "usage: cloudabi-run [-e [-l spins] [-m file] [-p] [-P file] "
+          "[-s | -S file]] executable\n");
   exit(127);
 }
 
 int main(int argc, char *argv[]) {
   // Parse command line options.
   bool do_emulate = false;
+  FILE *stats_out = NULL;
+  bool stats_json = false;
+  const char *metrics_path = NULL;
+  bool do_perfmap = false;
+  FILE *profile_out = NULL;
+  bool set_spin_limit = false;
+  unsigned long spin_limit = 0;
   char c;
-  while ((c = getopt(argc, argv, "e")) != -1) {
+  while ((c = getopt(argc, argv, "el:m:pP:S:s")) != -1) {
     switch (c) {
       case 'e':
         // Run program using emulation.
         do_emulate = true;
         break;
+      case 'l': {
+        // Bound the number of iterations spent spinning on locks.
+        char *endptr;
+        errno = 0;
+        spin_limit = strtoul(optarg, &endptr, 10);
+        if (errno != 0 || *optarg == '\0' || *endptr != '\0' ||
+            spin_limit > UINT_MAX)
+          usage();
+        set_spin_limit = true;
+        break;
+      }
+      case 'm':
+        // Expose live metrics through a file.
+        metrics_path = optarg;
+        break;
+      case 'p':
+        // Write a perf map for the executable.
+        do_perfmap = true;
+        break;
+      case 'P':
+        // Write sampled call stacks to a file.
+        profile_out = fopen(optarg, "w");
+        if (profile_out == NULL) {
+          perror("Failed to open profile file");
+          exit(127);
+        }
+        break;
+      case 'S':
+        // Write system call statistics as JSON to a file.
+        stats_out = fopen(optarg, "w");
+        if (stats_out == NULL) {
+          perror("Failed to open statistics file");
+          exit(127);
+        }
+        stats_json = true;
+        break;
+      case 's':
+        // Print system call statistics.
+        stats_out = stderr;
+        stats_json = false;
+        break;
       default:
         usage();
     }
   }
   argv += optind;
   argc -= optind;
-  if (argc != 1)
+  if (argc != 1 ||
+      ((set_spin_limit || stats_out != NULL || metrics_path != NULL ||
+        do_perfmap || profile_out != NULL) &&
+       !do_emulate))
     usage();
 
   // Parse YAML configuration.
   yaml_parser_t parser;
   yaml_parser_initialize(&parser);
   yaml_parser_set_input_file(&parser, stdin);
+  arena = argdata_arena_create();
+  if (arena == NULL) {
+    perror("Cannot allocate argument data");
+    exit(127);
+  }
   const argdata_t *ad = parse_object(&parser);
   yaml_parser_delete(&parser);
+  free(scratch);
 
   if (do_emulate) {
     // Serialize argument data that needs to be passed to the executable.
+    void *buf;
     size_t buflen, fdslen;
-    argdata_get_buffer_length(ad, &buflen, &fdslen);
-    int *fds = malloc(fdslen * sizeof(fds[0]) + buflen);
-    if (fds == NULL) {
+    int *fds;
+    errno = argdata_encode(ad, &buf, &buflen, &fds, &fdslen);
+    if (errno != 0) {
       perror("Cannot allocate argument data buffer");
       exit(127);
     }
-    void *buf = &fds[fdslen];
-    fdslen = argdata_get_buffer(ad, buf, fds);
+    argdata_arena_free(arena);
 
     // Register file descriptors.
     struct fd_table ft;
@@ -444,6 +551,7 @@ int main(int argc, char *argv[]) {
         exit(127);
       }
     }
+    free(fds);
 
     // Call into the emulator to run the program inside of this process.
     // Throw a warning message before beginning execution, as emulation
@@ -460,7 +568,21 @@ int main(int argc, char *argv[]) {
             "purposes, using this emulator in production is strongly\n"
             "discouraged.\n");
 
-    emulate(fd, buf, buflen, &posix_syscalls);
+    if (set_spin_limit)
+      futex_set_spin_limit(spin_limit);
+    emulate_set_perfmap(do_perfmap);
+    emulate_set_profile(profile_out);
+    if (metrics_path != NULL && !metrics_start(metrics_path, &ft)) {
+      perror("Failed to create metrics file");
+      exit(127);
+    }
+    if (stats_out != NULL) {
+      // Record statistics of all system calls made by the executable.
+      stats_init(&posix_syscalls, stats_out, stats_json);
+      emulate(fd, buf, buflen, &stats_syscalls);
+    } else {
+      emulate(fd, buf, buflen, &posix_syscalls);
+    }
   } else {
     // Execute the application directly through the operating system.
     int fd = open(argv[0], O_EXEC);
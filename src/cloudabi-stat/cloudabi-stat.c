@@ -0,0 +1,154 @@
+// Copyright (c) 2016 Nuxi, https://nuxi.nl/
+//
+// This file is distributed under a 2-clause BSD license.
+// See the LICENSE file for details.
+
+// cloudabi-stat - report live metrics of emulated CloudABI programs
+//
+// The cloudabi-stat utility periodically prints the metrics that
+// cloudabi-run writes to a file when started with -m, similar to
+// vmstat. The metrics are read from a shared memory mapping, meaning
+// that observing a program does not interrupt it.
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#ifndef __NetBSD__
+#include <stdnoreturn.h>
+#else
+#define noreturn _Noreturn
+#endif
+#include <unistd.h>
+
+#include "../libemulator/metrics.h"
+
+// Consistent copy of the metrics.
+struct sample {
+  uint64_t timestamp_ns;
+  uint64_t fds_size;
+  uint64_t fds_used;
+  uint64_t threads;
+  uint64_t futex_waiters;
+  uint64_t syscalls;
+  uint64_t rss_bytes;
+  uint64_t fd_objects;
+  uint64_t scratch_chunks;
+};
+
+static uint64_t get(const _Atomic(uint64_t) *value) {
+  return atomic_load_explicit(value, memory_order_relaxed);
+}
+
+static void sample_read(const struct metrics *m, struct sample *s) {
+  for (;;) {
+    uint64_t sequence =
+        atomic_load_explicit(&m->sequence, memory_order_acquire);
+    if (sequence % 2 == 0) {
+      s->timestamp_ns = get(&m->timestamp_ns);
+      s->fds_size = get(&m->fds_size);
+      s->fds_used = get(&m->fds_used);
+      s->threads = get(&m->threads);
+      s->futex_waiters = get(&m->futex_waiters);
+      s->syscalls = get(&m->syscalls);
+      s->rss_bytes = get(&m->rss_bytes);
+      s->fd_objects = get(&m->fd_objects);
+      s->scratch_chunks = get(&m->scratch_chunks);
+      atomic_thread_fence(memory_order_acquire);
+      if (atomic_load_explicit(&m->sequence, memory_order_relaxed) == sequence)
+        return;
+    }
+    // Emulator is in the middle of an update.
+    sched_yield();
+  }
+}
+
+static noreturn void usage(void) {
+  fprintf(stderr, "usage: cloudabi-stat file [interval [count]]\n");
+  exit(1);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2 || argc > 4)
+    usage();
+  unsigned long interval = 1, count = 0;
+  char *end;
+  if (argc > 2) {
+    interval = strtoul(argv[2], &end, 10);
+    if (*end != '\0' || interval == 0)
+      usage();
+  }
+  if (argc > 3) {
+    count = strtoul(argv[3], &end, 10);
+    if (*end != '\0' || count == 0)
+      usage();
+  }
+
+  // Map the metrics written by the emulator.
+  int fd = open(argv[1], O_RDONLY);
+  if (fd == -1) {
+    perror("Failed to open metrics file");
+    return 1;
+  }
+  struct stat sb;
+  if (fstat(fd, &sb) == -1) {
+    perror("Failed to stat metrics file");
+    return 1;
+  }
+  if (sb.st_size < (off_t)sizeof(struct metrics)) {
+    fprintf(stderr, "%s: Not a metrics file\n", argv[1]);
+    return 1;
+  }
+  const struct metrics *m =
+      mmap(NULL, sizeof(*m), PROT_READ, MAP_SHARED, fd, 0);
+  if (m == MAP_FAILED) {
+    perror("Failed to map metrics file");
+    return 1;
+  }
+  close(fd);
+  if (atomic_load_explicit(&m->magic, memory_order_acquire) != METRICS_MAGIC ||
+      m->version != METRICS_VERSION) {
+    fprintf(stderr, "%s: Not a metrics file\n", argv[1]);
+    return 1;
+  }
+
+  // Like vmstat, let the first line show the average number of system
+  // calls per second since the program started.
+  struct sample prev = {.timestamp_ns = m->start_ns};
+  printf("%8s %8s %8s %8s %12s %12s %8s %8s\n", "threads", "waiters", "fds",
+         "fdsize", "syscalls/s", "rss KiB", "fdobjs", "chunks");
+  for (unsigned long i = 0;; ++i) {
+    struct sample cur;
+    sample_read(m, &cur);
+    uint64_t elapsed = cur.timestamp_ns - prev.timestamp_ns;
+    uint64_t rate =
+        elapsed == 0
+            ? 0
+            : (uint64_t)((cur.syscalls - prev.syscalls) * 1e9 / elapsed);
+    printf("%8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %12" PRIu64
+           " %12" PRIu64 " %8" PRIu64 " %8" PRIu64 "\n",
+           cur.threads, cur.futex_waiters, cur.fds_used, cur.fds_size, rate,
+           cur.rss_bytes / 1024, cur.fd_objects, cur.scratch_chunks);
+    fflush(stdout);
+    prev = cur;
+
+    if (count != 0 && i + 1 >= count)
+      return 0;
+    sleep(interval);
+
+    // Stop once the emulator has terminated.
+    if (kill(m->pid, 0) == -1 && errno == ESRCH) {
+      fprintf(stderr, "%s: Process %" PRIu64 " has terminated\n", argv[1],
+              m->pid);
+      return 0;
+    }
+  }
+}
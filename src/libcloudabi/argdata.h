@@ -36,6 +36,11 @@ typedef struct cloudabi_argdata argdata_t;
 #define CLOUDABI_ARGDATA_T_DECLARED
 #endif
 
+// Arena from which argument data objects can be allocated. All objects
+// allocated from an arena are released at once by argdata_arena_free().
+// Objects allocated from an arena must not be passed to argdata_free().
+typedef struct cloudabi_argdata_arena argdata_arena_t;
+
 typedef struct {
   _Alignas(long) int error;
   char data[128];
@@ -46,6 +51,25 @@ typedef struct {
   char data[128];
 } argdata_seq_iterator_t;
 
+typedef struct {
+  _Alignas(long) int error;
+  char data[128];
+} argdata_map_index_t;
+
+// Amount of storage argdata_map_index() needs to build a hash index
+// for a map with a given number of entries.
+#define ARGDATA_MAP_INDEX_STORAGE(entries) ((size_t)(entries)*16)
+
+typedef struct {
+  _Alignas(long) int error;
+  char data[128];
+} argdata_seq_index_t;
+
+// Amount of storage argdata_seq_index() needs to record the position
+// of every entry of a sequence. Less storage causes the position of
+// only every 2nd, 4th, 8th, etc. entry to be recorded.
+#define ARGDATA_SEQ_INDEX_STORAGE(entries) ((size_t)(entries)*4)
+
 struct timespec;
 
 extern const argdata_t argdata_false;
@@ -55,6 +79,26 @@ extern const argdata_t argdata_true;
 #ifdef __cplusplus
 extern "C" {
 #endif
+void *argdata_arena_alloc(argdata_arena_t *, size_t);
+argdata_arena_t *argdata_arena_create(void);
+argdata_t *argdata_arena_create_binary(argdata_arena_t *, const void *,
+                                       size_t);
+argdata_t *argdata_arena_create_buffer(argdata_arena_t *, const void *,
+                                       size_t);
+argdata_t *argdata_arena_create_fd(argdata_arena_t *, int);
+argdata_t *argdata_arena_create_float(argdata_arena_t *, double);
+argdata_t *cloudabi_argdata_arena_create_int_s(argdata_arena_t *, intmax_t);
+argdata_t *cloudabi_argdata_arena_create_int_u(argdata_arena_t *, uintmax_t);
+argdata_t *argdata_arena_create_map(argdata_arena_t *,
+                                    argdata_t const *const *,
+                                    argdata_t const *const *, size_t);
+argdata_t *argdata_arena_create_seq(argdata_arena_t *,
+                                    argdata_t const *const *, size_t);
+argdata_t *argdata_arena_create_str(argdata_arena_t *, const char *, size_t);
+argdata_t *argdata_arena_create_str_c(argdata_arena_t *, const char *);
+argdata_t *argdata_arena_create_timestamp(argdata_arena_t *,
+                                          const struct timespec *);
+void argdata_arena_free(argdata_arena_t *);
 argdata_t *argdata_create_binary(const void *, size_t);
 argdata_t *argdata_create_buffer(const void *, size_t);
 argdata_t *argdata_create_fd(int);
@@ -67,6 +111,7 @@ argdata_t *argdata_create_seq(argdata_t const *const *, size_t);
 argdata_t *argdata_create_str(const char *, size_t);
 argdata_t *argdata_create_str_c(const char *);
 argdata_t *argdata_create_timestamp(const struct timespec *);
+int argdata_encode(const argdata_t *, void **, size_t *, int **, size_t *);
 void argdata_free(argdata_t *);
 int argdata_get_binary(const argdata_t *, const void **, size_t *);
 void argdata_get_buffer_length(const argdata_t *, size_t *, size_t *);
@@ -80,10 +125,20 @@ int cloudabi_argdata_get_int_u(const argdata_t *, uintmax_t *, uintmax_t);
 int argdata_get_str(const argdata_t *, const char **, size_t *);
 int argdata_get_str_c(const argdata_t *, const char **);
 int argdata_get_timestamp(const argdata_t *, struct timespec *);
+int argdata_map_get(argdata_map_index_t *, const argdata_t *,
+                    const argdata_t **);
+int argdata_map_get_str(argdata_map_index_t *, const char *,
+                        const argdata_t **);
+int argdata_map_index(const argdata_t *, argdata_map_index_t *, void *,
+                      size_t);
 int argdata_map_iterate(const argdata_t *, argdata_map_iterator_t *);
 _Bool argdata_map_next(argdata_map_iterator_t *, const argdata_t **,
                        const argdata_t **);
+int argdata_seq_get(argdata_seq_index_t *, size_t, const argdata_t **);
+int argdata_seq_index(const argdata_t *, argdata_seq_index_t *, void *,
+                      size_t);
 int argdata_seq_iterate(const argdata_t *, argdata_seq_iterator_t *);
+int argdata_seq_length(argdata_seq_index_t *, size_t *);
 _Bool argdata_seq_next(argdata_seq_iterator_t *, const argdata_t **);
 #ifdef __cplusplus
 }
@@ -143,6 +198,20 @@ CLOUDABI_ARGDATA_INT_U(unsigned long long, ullong, ULONG_MAX)
            unsigned long: cloudabi_argdata_create_int_u,  \
            long long: cloudabi_argdata_create_int_s,      \
            unsigned long long: cloudabi_argdata_create_int_u)(value)
+#define argdata_arena_create_int(arena, value)                  \
+  _Generic(value,                                               \
+           char: cloudabi_argdata_arena_create_int_s,           \
+           signed char: cloudabi_argdata_arena_create_int_s,    \
+           unsigned char: cloudabi_argdata_arena_create_int_u,  \
+           short: cloudabi_argdata_arena_create_int_s,          \
+           unsigned short: cloudabi_argdata_arena_create_int_u, \
+           int: cloudabi_argdata_arena_create_int_s,            \
+           unsigned int: cloudabi_argdata_arena_create_int_u,   \
+           long: cloudabi_argdata_arena_create_int_s,           \
+           unsigned long: cloudabi_argdata_arena_create_int_u,  \
+           long long: cloudabi_argdata_arena_create_int_s,      \
+           unsigned long long:                                  \
+               cloudabi_argdata_arena_create_int_u)(arena, value)
 #define argdata_get_int(ad, value)                          \
   _Generic(*(value),                                        \
            char: cloudabi_argdata_get_int_char,             \
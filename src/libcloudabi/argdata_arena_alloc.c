@@ -0,0 +1,62 @@
+// Copyright (c) 2016 Nuxi, https://nuxi.nl/
+//
+// This file is distributed under a 2-clause BSD license.
+// See the LICENSE file for details.
+
+#include <argdata.h>
+#include <errno.h>
+#include <stdalign.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "argdata_impl.h"
+
+void *argdata_arena_alloc(argdata_arena_t *arena, size_t len) {
+  // Round up the length, so that all allocations remain aligned. Empty
+  // allocations still yield a unique non-null pointer, like malloc().
+  if (len == 0)
+    len = 1;
+  const size_t align = alignof(max_align_t);
+  if (len > SIZE_MAX - sizeof(struct cloudabi_argdata_arena_chunk) - align) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  len = (len + align - 1) & ~(align - 1);
+
+  // Fast path: allocate from the current chunk.
+  if (len <= arena->left) {
+    void *p = arena->next;
+    arena->next += len;
+    arena->left -= len;
+    return p;
+  }
+
+  struct cloudabi_argdata_arena_chunk *chunk;
+  if (len > arena->chunksize / 4) {
+    // Large allocations obtain a chunk of their own. Place it behind
+    // the current chunk, so that its free space remains usable.
+    chunk = malloc(sizeof(*chunk) + len);
+    if (chunk == NULL)
+      return NULL;
+    if (arena->chunks == NULL) {
+      chunk->next = NULL;
+      arena->chunks = chunk;
+    } else {
+      chunk->next = arena->chunks->next;
+      arena->chunks->next = chunk;
+    }
+    return chunk->data;
+  }
+
+  // Start a new chunk, discarding the remainder of the current one.
+  chunk = malloc(sizeof(*chunk) + arena->chunksize);
+  if (chunk == NULL)
+    return NULL;
+  chunk->next = arena->chunks;
+  arena->chunks = chunk;
+  arena->next = (char *)chunk->data + len;
+  arena->left = arena->chunksize - len;
+  if (arena->chunksize < ARGDATA_ARENA_CHUNK_MAX)
+    arena->chunksize *= 2;
+  return chunk->data;
+}
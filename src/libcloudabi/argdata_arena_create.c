@@ -0,0 +1,20 @@
+// Copyright (c) 2016 Nuxi, https://nuxi.nl/
+//
+// This file is distributed under a 2-clause BSD license.
+// See the LICENSE file for details.
+
+#include <argdata.h>
+#include <stdlib.h>
+
+#include "argdata_impl.h"
+
+argdata_arena_t *argdata_arena_create(void) {
+  argdata_arena_t *arena = malloc(sizeof(*arena));
+  if (arena == NULL)
+    return NULL;
+  arena->chunks = NULL;
+  arena->next = NULL;
+  arena->left = 0;
+  arena->chunksize = ARGDATA_ARENA_CHUNK_MIN;
+  return arena;
+}
@@ -0,0 +1,21 @@
+// Copyright (c) 2016 Nuxi, https://nuxi.nl/
+//
+// This file is distributed under a 2-clause BSD license.
+// See the LICENSE file for details.
+
+#include <argdata.h>
+#include <stdlib.h>
+
+#include "argdata_impl.h"
+
+void argdata_arena_free(argdata_arena_t *arena) {
+  if (arena == NULL)
+    return;
+  struct cloudabi_argdata_arena_chunk *chunk = arena->chunks;
+  while (chunk != NULL) {
+    struct cloudabi_argdata_arena_chunk *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+  free(arena);
+}
@@ -8,8 +8,9 @@
 
 #include "argdata_impl.h"
 
-argdata_t *argdata_create_binary(const void *buf, size_t len) {
-  argdata_t *ad = malloc(sizeof(*ad));
+argdata_t *argdata_arena_create_binary(argdata_arena_t *arena,
+                                       const void *buf, size_t len) {
+  argdata_t *ad = argdata_alloc(arena, sizeof(*ad));
   if (ad == NULL)
     return NULL;
 
@@ -19,3 +20,7 @@ argdata_t *argdata_create_binary(const void *buf, size_t len) {
   ad->length = len + 1;
   return ad;
 }
+
+argdata_t *argdata_create_binary(const void *buf, size_t len) {
+  return argdata_arena_create_binary(NULL, buf, len);
+}
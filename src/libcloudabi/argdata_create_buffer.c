@@ -8,10 +8,15 @@
 
 #include "argdata_impl.h"
 
-argdata_t *argdata_create_buffer(const void *buf, size_t len) {
-  argdata_t *ad = malloc(sizeof(*ad));
+argdata_t *argdata_arena_create_buffer(argdata_arena_t *arena,
+                                       const void *buf, size_t len) {
+  argdata_t *ad = argdata_alloc(arena, sizeof(*ad));
   if (ad == NULL)
     return NULL;
   argdata_init_buffer(ad, buf, len);
   return ad;
 }
+
+argdata_t *argdata_create_buffer(const void *buf, size_t len) {
+  return argdata_arena_create_buffer(NULL, buf, len);
+}
@@ -10,7 +10,7 @@
 
 #include "argdata_impl.h"
 
-argdata_t *argdata_create_fd(int value) {
+argdata_t *argdata_arena_create_fd(argdata_arena_t *arena, int value) {
   // We should only refer to valid file descriptors.
   if (value < 0 || (uintmax_t)value > UINT32_MAX) {
     errno = EBADF;
@@ -18,7 +18,7 @@ argdata_t *argdata_create_fd(int value) {
   }
 
   // Allocate object with space for encoded integer value.
-  argdata_t *ad = malloc(sizeof(*ad) + sizeof(uint32_t) + 1);
+  argdata_t *ad = argdata_alloc(arena, sizeof(*ad) + sizeof(uint32_t) + 1);
   if (ad == NULL)
     return NULL;
 
@@ -34,3 +34,7 @@ argdata_t *argdata_create_fd(int value) {
   ad->length = buf - bufstart;
   return ad;
 }
+
+argdata_t *argdata_create_fd(int value) {
+  return argdata_arena_create_fd(NULL, value);
+}
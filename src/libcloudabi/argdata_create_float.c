@@ -10,7 +10,7 @@
 
 #include "argdata_impl.h"
 
-argdata_t *argdata_create_float(double value) {
+argdata_t *argdata_arena_create_float(argdata_arena_t *arena, double value) {
 #if DBL_MANT_DIG == 53
   // Extract bits for the floating point value.
   union {
@@ -23,7 +23,8 @@ argdata_t *argdata_create_float(double value) {
 #endif
 
   // Allocate object with space for floating point value.
-  argdata_t *ad = malloc(sizeof(argdata_t) + sizeof(uint64_t) + 1);
+  argdata_t *ad =
+      argdata_alloc(arena, sizeof(argdata_t) + sizeof(uint64_t) + 1);
   if (ad == NULL)
     return NULL;
 
@@ -40,3 +41,7 @@ argdata_t *argdata_create_float(double value) {
   ad->length = sizeof(uint64_t) + 1;
   return ad;
 }
+
+argdata_t *argdata_create_float(double value) {
+  return argdata_arena_create_float(NULL, value);
+}
@@ -9,14 +9,15 @@
 
 #include "argdata_impl.h"
 
-argdata_t *cloudabi_argdata_create_int_s(intmax_t value) {
+argdata_t *cloudabi_argdata_arena_create_int_s(argdata_arena_t *arena,
+                                               intmax_t value) {
   // Treat non-negative numbers as unsigned.
   if (value >= 0)
-    return cloudabi_argdata_create_int_u(value);
+    return cloudabi_argdata_arena_create_int_u(arena, value);
 
   // Allocate object with space for encoded integer value.
   static const size_t objlen = sizeof(argdata_t) + sizeof(uintmax_t) + 1;
-  argdata_t *ad = malloc(objlen);
+  argdata_t *ad = argdata_alloc(arena, objlen);
   if (ad == NULL)
     return NULL;
 
@@ -38,3 +39,7 @@ argdata_t *cloudabi_argdata_create_int_s(intmax_t value) {
   ad->length = len;
   return ad;
 }
+
+argdata_t *cloudabi_argdata_create_int_s(intmax_t value) {
+  return cloudabi_argdata_arena_create_int_s(NULL, value);
+}
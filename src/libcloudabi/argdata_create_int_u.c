@@ -9,10 +9,11 @@
 
 #include "argdata_impl.h"
 
-argdata_t *cloudabi_argdata_create_int_u(uintmax_t value) {
+argdata_t *cloudabi_argdata_arena_create_int_u(argdata_arena_t *arena,
+                                               uintmax_t value) {
   // Allocate object with space for encoded integer value.
   static const size_t objlen = sizeof(argdata_t) + sizeof(uintmax_t) + 2;
-  argdata_t *ad = malloc(objlen);
+  argdata_t *ad = argdata_alloc(arena, objlen);
   if (ad == NULL)
     return NULL;
 
@@ -41,3 +42,7 @@ argdata_t *cloudabi_argdata_create_int_u(uintmax_t value) {
   ad->length = len;
   return ad;
 }
+
+argdata_t *cloudabi_argdata_create_int_u(uintmax_t value) {
+  return cloudabi_argdata_arena_create_int_u(NULL, value);
+}
@@ -8,9 +8,11 @@
 
 #include "argdata_impl.h"
 
-argdata_t *argdata_create_map(argdata_t const *const *keys,
-                              argdata_t const *const *values, size_t count) {
-  argdata_t *ad = malloc(sizeof(*ad));
+argdata_t *argdata_arena_create_map(argdata_arena_t *arena,
+                                    argdata_t const *const *keys,
+                                    argdata_t const *const *values,
+                                    size_t count) {
+  argdata_t *ad = argdata_alloc(arena, sizeof(*ad));
   if (ad == NULL)
     return NULL;
 
@@ -25,3 +27,8 @@ argdata_t *argdata_create_map(argdata_t const *const *keys,
   }
   return ad;
 }
+
+argdata_t *argdata_create_map(argdata_t const *const *keys,
+                              argdata_t const *const *values, size_t count) {
+  return argdata_arena_create_map(NULL, keys, values, count);
+}
@@ -8,8 +8,10 @@
 
 #include "argdata_impl.h"
 
-argdata_t *argdata_create_seq(argdata_t const *const *entries, size_t count) {
-  argdata_t *ad = malloc(sizeof(*ad));
+argdata_t *argdata_arena_create_seq(argdata_arena_t *arena,
+                                    argdata_t const *const *entries,
+                                    size_t count) {
+  argdata_t *ad = argdata_alloc(arena, sizeof(*ad));
   if (ad == NULL)
     return NULL;
 
@@ -21,3 +23,7 @@ argdata_t *argdata_create_seq(argdata_t const *const *entries, size_t count) {
     ad->length += get_subfield_length(entries[i]);
   return ad;
 }
+
+argdata_t *argdata_create_seq(argdata_t const *const *entries, size_t count) {
+  return argdata_arena_create_seq(NULL, entries, count);
+}
@@ -9,7 +9,8 @@
 
 #include "argdata_impl.h"
 
-argdata_t *argdata_create_str(const char *buf, size_t len) {
+argdata_t *argdata_arena_create_str(argdata_arena_t *arena, const char *buf,
+                                    size_t len) {
   // Validate the string for encoding errors.
   int error = validate_string(buf, len);
   if (error != 0) {
@@ -17,7 +18,7 @@ argdata_t *argdata_create_str(const char *buf, size_t len) {
     return NULL;
   }
 
-  argdata_t *ad = malloc(sizeof(*ad));
+  argdata_t *ad = argdata_alloc(arena, sizeof(*ad));
   if (ad == NULL)
     return NULL;
 
@@ -28,3 +29,7 @@ argdata_t *argdata_create_str(const char *buf, size_t len) {
   ad->length = len + 2;
   return ad;
 }
+
+argdata_t *argdata_create_str(const char *buf, size_t len) {
+  return argdata_arena_create_str(NULL, buf, len);
+}
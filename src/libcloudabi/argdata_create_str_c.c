@@ -9,3 +9,8 @@
 argdata_t *argdata_create_str_c(const char *value) {
   return argdata_create_str(value, strlen(value));
 }
+
+argdata_t *argdata_arena_create_str_c(argdata_arena_t *arena,
+                                      const char *value) {
+  return argdata_arena_create_str(arena, value, strlen(value));
+}
@@ -12,7 +12,8 @@
 
 #include "argdata_impl.h"
 
-argdata_t *argdata_create_timestamp(const struct timespec *ts) {
+argdata_t *argdata_arena_create_timestamp(argdata_arena_t *arena,
+                                          const struct timespec *ts) {
   // Extract values from the timestamp.
   if (ts->tv_nsec < 0 || ts->tv_nsec >= 1000000000) {
     errno = EINVAL;
@@ -25,7 +26,7 @@ argdata_t *argdata_create_timestamp(const struct timespec *ts) {
   // Allocate object with space for encoded timestamp. The timestamp can
   // at most be 12 bytes long.
   static const size_t objlen = sizeof(argdata_t) + 13;
-  argdata_t *ad = malloc(objlen);
+  argdata_t *ad = argdata_alloc(arena, objlen);
   if (ad == NULL)
     return NULL;
   uint8_t *buf_end = (uint8_t *)ad + objlen;
@@ -56,3 +57,7 @@ argdata_t *argdata_create_timestamp(const struct timespec *ts) {
   ad->length = buf_end - buf;
   return ad;
 }
+
+argdata_t *argdata_create_timestamp(const struct timespec *ts) {
+  return argdata_arena_create_timestamp(NULL, ts);
+}
@@ -0,0 +1,238 @@
+// Copyright (c) 2016 Nuxi, https://nuxi.nl/
+//
+// This file is distributed under a 2-clause BSD license.
+// See the LICENSE file for details.
+
+#include <argdata.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "argdata_impl.h"
+
+// Map or sequence whose entries are still being encoded.
+struct encode_frame {
+  enum { FRAME_BUFFER, FRAME_MAP, FRAME_SEQ } type;
+  union {
+    struct {
+      const uint8_t *buf;
+      size_t len;
+    } buffer;  // Remaining entries of an encoded map or sequence.
+    struct {
+      const argdata_t *ad;
+      size_t index;
+    } node;  // Next entry of a map or sequence node.
+  };
+};
+
+// Number of frames that can be stored without allocating memory.
+#define ENCODE_FRAMES_INLINE 32
+
+struct encoder {
+  uint8_t *out;  // Position in the output buffer.
+
+  // Renumbering of file descriptors, if requested.
+  bool remap;
+  struct fd_mapper fds;
+  size_t fdsspace;
+
+  // Stack of maps and sequences being encoded.
+  struct encode_frame *stack;
+  size_t depth;
+  size_t stackspace;
+  struct encode_frame inline_stack[ENCODE_FRAMES_INLINE];
+};
+
+static bool encode_push(struct encoder *e, struct encode_frame frame) {
+  if (e->depth == e->stackspace) {
+    // Move the stack to the heap once it no longer fits inline.
+    size_t space = e->stackspace * 2;
+    struct encode_frame *stack;
+    if (e->stack == e->inline_stack) {
+      stack = malloc(space * sizeof(*stack));
+      if (stack == NULL)
+        return false;
+      memcpy(stack, e->inline_stack, sizeof(e->inline_stack));
+    } else {
+      stack = realloc(e->stack, space * sizeof(*stack));
+      if (stack == NULL)
+        return false;
+    }
+    e->stack = stack;
+    e->stackspace = space;
+  }
+  e->stack[e->depth++] = frame;
+  return true;
+}
+
+static bool encode_fd_number(struct encoder *e, int fd) {
+  // Make space for a descriptor that has not been seen before.
+  if (e->fds.fdslen == e->fdsspace) {
+    size_t space = e->fdsspace < 8 ? 8 : e->fdsspace * 2;
+    int *fds = realloc(e->fds.fds, space * sizeof(*fds));
+    if (fds == NULL)
+      return false;
+    e->fds.fds = fds;
+    e->fdsspace = space;
+  }
+  encode_fd(fd_mapper_map(&e->fds, fd), &e->out);
+  return true;
+}
+
+// Emits a single node. Maps and sequences only have their type byte
+// emitted, with a frame being pushed to emit their entries.
+static bool encode_node(struct encoder *e, const argdata_t *ad) {
+  // Skip empty nodes.
+  if (ad->length == 0)
+    return true;
+
+  switch (ad->type) {
+    case AD_BUFFER: {
+      const uint8_t *ibuf = ad->buffer;
+      size_t ilen = ad->length;
+
+      if (e->remap) {
+        // Copy over the field type byte.
+        --ilen;
+        switch ((*e->out++ = *ibuf++)) {
+          case ADT_MAP:
+          case ADT_SEQ:
+            // Scan map and sequence entries for file descriptors.
+            return encode_push(
+                e, (struct encode_frame){.type = FRAME_BUFFER,
+                                         .buffer = {.buf = ibuf,
+                                                    .len = ilen}});
+          case ADT_FD: {
+            // Remap file descriptors to be sequential starting at zero.
+            int fd;
+            if (parse_fd(&fd, &ibuf, &ilen) == 0 && !encode_fd_number(e, fd))
+              return false;
+            break;
+          }
+        }
+      }
+
+      // (Remainder of the) payload that is unsupported by this
+      // implementation or does not contain a file descriptor. Copy it
+      // over literally, so that its structure remains identical to the
+      // original.
+      memcpy(e->out, ibuf, ilen);
+      e->out += ilen;
+      return true;
+    }
+    case AD_BINARY:
+      // Copy over the binary payload.
+      *e->out++ = ADT_BINARY;
+      memcpy(e->out, ad->binary, ad->length - 1);
+      e->out += ad->length - 1;
+      return true;
+    case AD_MAP:
+      *e->out++ = ADT_MAP;
+      return encode_push(
+          e, (struct encode_frame){.type = FRAME_MAP,
+                                   .node = {.ad = ad, .index = 0}});
+    case AD_SEQ:
+      *e->out++ = ADT_SEQ;
+      return encode_push(
+          e, (struct encode_frame){.type = FRAME_SEQ,
+                                   .node = {.ad = ad, .index = 0}});
+    case AD_STR:
+      // Copy over the string payload and add a terminating null byte.
+      *e->out++ = ADT_STR;
+      memcpy(e->out, ad->str, ad->length - 2);
+      e->out += ad->length - 2;
+      *e->out++ = '\0';
+      return true;
+  }
+  return true;
+}
+
+// Emits a tree of nodes, using an explicit stack instead of recursion,
+// so that deeply nested data cannot exhaust the call stack.
+static bool encode_tree(struct encoder *e, const argdata_t *ad) {
+  if (!encode_node(e, ad))
+    return false;
+  while (e->depth > 0) {
+    // Fetch the next entry of the innermost map or sequence.
+    struct encode_frame *frame = &e->stack[e->depth - 1];
+    const argdata_t *child;
+    argdata_t iad;
+    switch (frame->type) {
+      case FRAME_BUFFER:
+        if (parse_subfield(&iad, &frame->buffer.buf, &frame->buffer.len) !=
+            0) {
+          // Copy over trailing data that could not be parsed.
+          memcpy(e->out, frame->buffer.buf, frame->buffer.len);
+          e->out += frame->buffer.len;
+          --e->depth;
+          continue;
+        }
+        child = &iad;
+        break;
+      case FRAME_MAP: {
+        const argdata_t *map = frame->node.ad;
+        size_t index = frame->node.index++;
+        if (index == map->map.count * 2) {
+          --e->depth;
+          continue;
+        }
+        child = index % 2 == 0 ? map->map.keys[index / 2]
+                               : map->map.values[index / 2];
+        break;
+      }
+      case FRAME_SEQ: {
+        const argdata_t *seq = frame->node.ad;
+        size_t index = frame->node.index++;
+        if (index == seq->seq.count) {
+          --e->depth;
+          continue;
+        }
+        child = seq->seq.entries[index];
+        break;
+      }
+      default:
+        abort();
+    }
+
+    // Emit the entry, prefixed by its length.
+    encode_subfield_length(child, &e->out);
+    if (!encode_node(e, child))
+      return false;
+  }
+  return true;
+}
+
+int argdata_encode(const argdata_t *ad, void **buf, size_t *buflen,
+                   int **fds, size_t *fdslen) {
+  // The length of the output is known in advance. Add a trailing null
+  // byte, so that the output can be used as a string directly.
+  uint8_t *out = malloc(ad->length + 1);
+  if (out == NULL)
+    return errno;
+
+  struct encoder e = {.out = out, .remap = fds != NULL};
+  fd_mapper_init(&e.fds, NULL);
+  e.stack = e.inline_stack;
+  e.stackspace = ENCODE_FRAMES_INLINE;
+  bool success = encode_tree(&e, ad);
+  fd_mapper_destroy(&e.fds);
+  if (e.stack != e.inline_stack)
+    free(e.stack);
+  if (!success) {
+    int error = errno;
+    free(out);
+    free(e.fds.fds);
+    return error;
+  }
+
+  out[ad->length] = '\0';
+  *buf = out;
+  *buflen = ad->length;
+  if (fds != NULL)
+    *fds = e.fds.fds;
+  if (fdslen != NULL)
+    *fdslen = e.fds.fdslen;
+  return 0;
+}
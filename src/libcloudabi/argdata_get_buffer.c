@@ -9,19 +9,9 @@
 
 #include "argdata_impl.h"
 
-static void encode_subfield(const argdata_t *, uint8_t **, int *, size_t *);
+static void encode_subfield(const argdata_t *, uint8_t **, struct fd_mapper *);
 
-static int map_fd(int fd, int *fds, size_t *fdslen) {
-  for (size_t i = 0; i < *fdslen; ++i)
-    if (fds[i] == fd)
-      return i;
-  size_t newfd = (*fdslen)++;
-  fds[newfd] = fd;
-  return newfd;
-}
-
-static void encode(const argdata_t *ad, uint8_t *buf, int *fds,
-                   size_t *fdslen) {
+static void encode(const argdata_t *ad, uint8_t *buf, struct fd_mapper *fds) {
   // Skip empty nodes.
   if (ad->length == 0)
     return;
@@ -42,7 +32,7 @@ static void encode(const argdata_t *ad, uint8_t *buf, int *fds,
               argdata_t iad;
               if (parse_subfield(&iad, &ibuf, &ilen) != 0)
                 break;
-              encode_subfield(&iad, &buf, fds, fdslen);
+              encode_subfield(&iad, &buf, fds);
             }
             break;
           }
@@ -50,7 +40,7 @@ static void encode(const argdata_t *ad, uint8_t *buf, int *fds,
             // Remap file descriptors to be sequential starting at zero.
             int fd;
             if (parse_fd(&fd, &ibuf, &ilen) == 0)
-              encode_fd(map_fd(fd, fds, fdslen), &buf);
+              encode_fd(fd_mapper_map(fds, fd), &buf);
             break;
           }
         }
@@ -72,15 +62,15 @@ static void encode(const argdata_t *ad, uint8_t *buf, int *fds,
       // Emit key and value for every map entry.
       *buf++ = ADT_MAP;
       for (size_t i = 0; i < ad->map.count; ++i) {
-        encode_subfield(ad->map.keys[i], &buf, fds, fdslen);
-        encode_subfield(ad->map.values[i], &buf, fds, fdslen);
+        encode_subfield(ad->map.keys[i], &buf, fds);
+        encode_subfield(ad->map.values[i], &buf, fds);
       }
       break;
     case AD_SEQ:
       // Emit every sequence entry.
       *buf++ = ADT_SEQ;
       for (size_t i = 0; i < ad->seq.count; ++i)
-        encode_subfield(ad->seq.entries[i], &buf, fds, fdslen);
+        encode_subfield(ad->seq.entries[i], &buf, fds);
       break;
     case AD_STR:
       // Copy over the string payload and add a terminating null byte.
@@ -91,15 +81,21 @@ static void encode(const argdata_t *ad, uint8_t *buf, int *fds,
   }
 }
 
-static void encode_subfield(const argdata_t *ad, uint8_t **buf, int *fds,
-                            size_t *fdslen) {
+static void encode_subfield(const argdata_t *ad, uint8_t **buf,
+                            struct fd_mapper *fds) {
   encode_subfield_length(ad, buf);
-  encode(ad, *buf, fds, fdslen);
+  encode(ad, *buf, fds);
   *buf += ad->length;
 }
 
 size_t argdata_get_buffer(const argdata_t *ad, void *buf, int *fds) {
-  size_t nfds = 0;
-  encode(ad, buf, fds, &nfds);
-  return nfds;
+  if (fds == NULL) {
+    encode(ad, buf, NULL);
+    return 0;
+  }
+  struct fd_mapper mapper;
+  fd_mapper_init(&mapper, fds);
+  encode(ad, buf, &mapper);
+  fd_mapper_destroy(&mapper);
+  return mapper.fdslen;
 }
@@ -17,6 +17,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <wchar.h>
 
@@ -40,6 +41,26 @@ struct cloudabi_argdata {
   size_t length;
 };
 
+// Chunk of memory from which arena allocations are made.
+struct cloudabi_argdata_arena_chunk {
+  struct cloudabi_argdata_arena_chunk *next;
+  max_align_t data[];
+};
+
+struct cloudabi_argdata_arena {
+  // Chunks of memory, most recently allocated first.
+  struct cloudabi_argdata_arena_chunk *chunks;
+
+  char *next;        // Start of the free space in the current chunk.
+  size_t left;       // Size of the free space in the current chunk.
+  size_t chunksize;  // Size of the next chunk to allocate.
+};
+
+// Initial and maximum size of the chunks allocated by an arena. Chunk
+// sizes grow geometrically, so that the number of chunks remains small.
+#define ARGDATA_ARENA_CHUNK_MIN 4096
+#define ARGDATA_ARENA_CHUNK_MAX 1048576
+
 struct cloudabi_argdata_map_iterator {
   alignas(long) int error;
   const argdata_t *container;
@@ -75,6 +96,69 @@ static_assert(offsetof(struct cloudabi_argdata_seq_iterator, error) ==
                   offsetof(argdata_seq_iterator_t, error),
               "Invalid offset");
 
+// Slot in the hash index of a map, referring to a key and its value.
+struct cloudabi_argdata_map_index_slot {
+  uint32_t hash;    // Hash of the key.
+  uint32_t offset;  // Offset of the key in the map, or zero if empty.
+};
+
+static_assert(sizeof(struct cloudabi_argdata_map_index_slot) * 2 ==
+                  ARGDATA_MAP_INDEX_STORAGE(1),
+              "Invalid size");
+
+struct cloudabi_argdata_map_index {
+  alignas(long) int error;
+  const argdata_t *container;
+  enum { INDEX_NONE, INDEX_PENDING, INDEX_BUILT } state;
+  struct cloudabi_argdata_map_index_slot *slots;
+  size_t nslots;
+  argdata_t value;
+};
+
+static_assert(sizeof(struct cloudabi_argdata_map_index) <=
+                  sizeof(argdata_map_index_t),
+              "Invalid size");
+static_assert(alignof(struct cloudabi_argdata_map_index) ==
+                  alignof(argdata_map_index_t),
+              "Invalid alignment");
+static_assert(offsetof(struct cloudabi_argdata_map_index, error) ==
+                  offsetof(argdata_map_index_t, error),
+              "Invalid offset");
+
+struct cloudabi_argdata_seq_index {
+  alignas(long) int error;
+  const argdata_t *container;
+
+  // Offsets of every (1 << shift)'th entry of a sequence backed by a
+  // buffer, or null if no storage was provided.
+  uint32_t *offsets;
+  unsigned int shift;
+
+  // Number of entries, or SIZE_MAX if not known yet. If the sequence is
+  // malformed, this is the number of entries preceding the error.
+  size_t length;
+  int tail_error;
+
+  // Entry following the one returned most recently, allowing
+  // sequential access without rescanning.
+  size_t cursor_index;
+  size_t cursor_offset;
+
+  argdata_t value;
+};
+
+static_assert(sizeof(uint32_t) == ARGDATA_SEQ_INDEX_STORAGE(1),
+              "Invalid size");
+static_assert(sizeof(struct cloudabi_argdata_seq_index) <=
+                  sizeof(argdata_seq_index_t),
+              "Invalid size");
+static_assert(alignof(struct cloudabi_argdata_seq_index) ==
+                  alignof(argdata_seq_index_t),
+              "Invalid alignment");
+static_assert(offsetof(struct cloudabi_argdata_seq_index, error) ==
+                  offsetof(argdata_seq_index_t, error),
+              "Invalid offset");
+
 enum {
   ADT_BINARY = 1,    // A sequence of zero or more octets.
   ADT_BOOL = 2,      // Mathematical Booleans.
@@ -87,6 +171,11 @@ enum {
   ADT_TIMESTAMP = 9  // A point in time.
 };
 
+// Allocates storage for an object, either from an arena or the heap.
+static inline void *argdata_alloc(argdata_arena_t *arena, size_t len) {
+  return arena != NULL ? argdata_arena_alloc(arena, len) : malloc(len);
+}
+
 static inline void argdata_init_buffer(argdata_t *ad, const void *buffer,
                                        size_t length) {
   ad->type = AD_BUFFER;
@@ -197,6 +286,88 @@ static inline void encode_fd(int value, uint8_t **buf) {
   *(*buf)++ = value;
 }
 
+// Renumbers file descriptors sequentially, in the order in which they
+// are first encountered. Small sets of descriptors are scanned
+// linearly. Larger sets are indexed by an open addressing hash table
+// that stores the new number of every descriptor, plus one.
+struct fd_mapper {
+  int *fds;  // Descriptors in the order of their new numbers.
+  size_t fdslen;
+  size_t *slots;  // Hash table, or null if not allocated.
+  size_t mask;
+  unsigned int shift;  // 64 minus the base-2 logarithm of the size.
+};
+
+// Number of descriptors up to which linear scanning is used.
+#define FD_MAPPER_LINEAR 8
+
+static inline void fd_mapper_init(struct fd_mapper *m, int *fds) {
+  m->fds = fds;
+  m->fdslen = 0;
+  m->slots = NULL;
+  m->mask = 0;
+  m->shift = 64;
+}
+
+static inline void fd_mapper_destroy(struct fd_mapper *m) {
+  free(m->slots);
+}
+
+static inline size_t fd_mapper_slot(const struct fd_mapper *m, int fd) {
+  // Fibonacci hashing. Taking the top bits of the product ensures that
+  // all bits of the descriptor number affect the slot.
+  return (uint64_t)(uint32_t)fd * UINT64_C(11400714819323198485) >> m->shift;
+}
+
+// Rebuilds the hash table, so that it is at most a quarter full. If no
+// memory can be allocated, linear scanning is used instead.
+static inline void fd_mapper_rebuild(struct fd_mapper *m) {
+  size_t size = 64;
+  unsigned int shift = 64 - 6;
+  while (size < m->fdslen * 4) {
+    size *= 2;
+    --shift;
+  }
+  free(m->slots);
+  m->slots = calloc(size, sizeof(m->slots[0]));
+  if (m->slots == NULL)
+    return;
+  m->mask = size - 1;
+  m->shift = shift;
+  for (size_t i = 0; i < m->fdslen; ++i) {
+    size_t slot = fd_mapper_slot(m, m->fds[i]);
+    while (m->slots[slot] != 0)
+      slot = (slot + 1) & m->mask;
+    m->slots[slot] = i + 1;
+  }
+}
+
+// Returns the new number of a file descriptor, assigning the next
+// number if it has not been encountered before. The descriptor array
+// must have space to hold an additional descriptor.
+static inline size_t fd_mapper_map(struct fd_mapper *m, int fd) {
+  size_t slot = 0;
+  if (m->slots != NULL) {
+    for (slot = fd_mapper_slot(m, fd); m->slots[slot] != 0;
+         slot = (slot + 1) & m->mask)
+      if (m->fds[m->slots[slot] - 1] == fd)
+        return m->slots[slot] - 1;
+  } else {
+    for (size_t i = 0; i < m->fdslen; ++i)
+      if (m->fds[i] == fd)
+        return i;
+  }
+
+  size_t newfd = m->fdslen++;
+  m->fds[newfd] = fd;
+  if (m->slots != NULL ? m->fdslen * 2 > m->mask + 1
+                       : m->fdslen > FD_MAPPER_LINEAR)
+    fd_mapper_rebuild(m);
+  else if (m->slots != NULL)
+    m->slots[slot] = newfd + 1;
+  return newfd;
+}
+
 // Validates whether a string uses valid UTF-8.
 static inline int validate_string(const char *buf, size_t len) {
   // This implementation acts as a placeholder outside of CloudABI.
@@ -0,0 +1,181 @@
+// Copyright (c) 2016 Nuxi, https://nuxi.nl/
+//
+// This file is distributed under a 2-clause BSD license.
+// See the LICENSE file for details.
+
+#include <argdata.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "argdata_impl.h"
+
+// Computes the FNV-1a hash of an encoded key.
+static uint32_t hash_key(const uint8_t *buf, size_t len) {
+  uint32_t hash = 2166136261;
+  for (size_t i = 0; i < len; ++i)
+    hash = (hash ^ buf[i]) * 16777619;
+  return hash;
+}
+
+// Maps a hash onto a slot of the index, without requiring the number of
+// slots to be a power of two.
+static size_t hash_slot(uint32_t hash, size_t nslots) {
+  return ((uint64_t)hash * nslots) >> 32;
+}
+
+// Returns the encoded form of a key. Keys that are not backed by a
+// buffer are encoded into temporary storage, which is allocated from
+// the heap if it does not fit in the space provided.
+static const uint8_t *get_key(const argdata_t *ad, uint8_t *tmp,
+                              size_t tmplen, uint8_t **alloc) {
+  *alloc = NULL;
+  if (ad->type == AD_BUFFER)
+    return ad->buffer;
+  uint8_t *buf = tmp;
+  if (ad->length > tmplen) {
+    buf = *alloc = malloc(ad->length);
+    if (buf == NULL)
+      return NULL;
+  }
+  argdata_get_buffer(ad, buf, NULL);
+  return buf;
+}
+
+// Builds the hash index of a map backed by a buffer. The index is not
+// used if the map is malformed or if the storage provided is too small
+// to keep it at most half full, causing lookups to scan the map.
+static void build_index(struct cloudabi_argdata_map_index *index) {
+  const argdata_t *ad = index->container;
+  index->state = INDEX_NONE;
+  if (ad->length > UINT32_MAX)
+    return;
+
+  struct cloudabi_argdata_map_index_slot *slots = index->slots;
+  size_t nslots = index->nslots;
+  memset(slots, 0, nslots * sizeof(slots[0]));
+  const uint8_t *buf = ad->buffer + 1;
+  size_t len = ad->length - 1;
+  size_t count = 0;
+  while (len > 0) {
+    uint32_t offset = buf - ad->buffer;
+    argdata_t key, value;
+    if (parse_subfield(&key, &buf, &len) != 0 ||
+        parse_subfield(&value, &buf, &len) != 0 || ++count * 2 > nslots)
+      return;
+
+    // Insert the key. Duplicate keys end up further down the chain, so
+    // that lookups yield the first occurrence, like scanning does.
+    uint32_t hash = hash_key(key.buffer, key.length);
+    size_t slot = hash_slot(hash, nslots);
+    while (slots[slot].offset != 0)
+      slot = slot + 1 == nslots ? 0 : slot + 1;
+    slots[slot].hash = hash;
+    slots[slot].offset = offset;
+  }
+  index->state = INDEX_BUILT;
+}
+
+// Looks up a key in a map backed by a buffer, using the hash index.
+static int lookup_index(struct cloudabi_argdata_map_index *index,
+                        const uint8_t *key, size_t keylen,
+                        const argdata_t **value) {
+  const argdata_t *ad = index->container;
+  const struct cloudabi_argdata_map_index_slot *slots = index->slots;
+  size_t nslots = index->nslots;
+  uint32_t hash = hash_key(key, keylen);
+  for (size_t slot = hash_slot(hash, nslots); slots[slot].offset != 0;
+       slot = slot + 1 == nslots ? 0 : slot + 1) {
+    if (slots[slot].hash == hash) {
+      // Entries have been validated while building the index, meaning
+      // that parsing them again cannot fail.
+      const uint8_t *buf = ad->buffer + slots[slot].offset;
+      size_t len = ad->length - slots[slot].offset;
+      argdata_t ikey;
+      if (parse_subfield(&ikey, &buf, &len) != 0)
+        return EINVAL;
+      if (ikey.length == keylen && memcmp(ikey.buffer, key, keylen) == 0) {
+        int error = parse_subfield(&index->value, &buf, &len);
+        if (error != 0)
+          return error;
+        *value = &index->value;
+        return 0;
+      }
+    }
+  }
+  return ENOENT;
+}
+
+// Looks up a key in a map backed by a buffer, by scanning all entries.
+static int lookup_scan(struct cloudabi_argdata_map_index *index,
+                       const uint8_t *key, size_t keylen,
+                       const argdata_t **value) {
+  const argdata_t *ad = index->container;
+  const uint8_t *buf = ad->buffer + 1;
+  size_t len = ad->length - 1;
+  while (len > 0) {
+    argdata_t ikey;
+    int error = parse_subfield(&ikey, &buf, &len);
+    if (error != 0)
+      return error;
+    error = parse_subfield(&index->value, &buf, &len);
+    if (error != 0)
+      return error;
+    if (ikey.length == keylen && memcmp(ikey.buffer, key, keylen) == 0) {
+      *value = &index->value;
+      return 0;
+    }
+  }
+  return ENOENT;
+}
+
+// Looks up a key in a map consisting of separate nodes.
+static int lookup_nodes(const argdata_t *ad, const uint8_t *key,
+                        size_t keylen, const argdata_t **value) {
+  for (size_t i = 0; i < ad->map.count; ++i) {
+    const argdata_t *ikey = ad->map.keys[i];
+    if (ikey->length == keylen) {
+      uint8_t tmp[64], *alloc;
+      const uint8_t *ikeybuf = get_key(ikey, tmp, sizeof(tmp), &alloc);
+      if (ikeybuf == NULL)
+        return errno;
+      bool equal = memcmp(ikeybuf, key, keylen) == 0;
+      free(alloc);
+      if (equal) {
+        *value = ad->map.values[i];
+        return 0;
+      }
+    }
+  }
+  return ENOENT;
+}
+
+int argdata_map_get(argdata_map_index_t *index_, const argdata_t *key,
+                    const argdata_t **value) {
+  struct cloudabi_argdata_map_index *index =
+      (struct cloudabi_argdata_map_index *)index_;
+  if (index->error != 0)
+    return index->error;
+
+  // Keys are compared by their encoded form.
+  uint8_t tmp[64], *alloc;
+  const uint8_t *keybuf = get_key(key, tmp, sizeof(tmp), &alloc);
+  if (keybuf == NULL)
+    return errno;
+
+  int error;
+  const argdata_t *ad = index->container;
+  if (ad->type == AD_BUFFER) {
+    if (index->state == INDEX_PENDING)
+      build_index(index);
+    error = index->state == INDEX_BUILT
+                ? lookup_index(index, keybuf, key->length, value)
+                : lookup_scan(index, keybuf, key->length, value);
+  } else {
+    error = lookup_nodes(ad, keybuf, key->length, value);
+  }
+  free(alloc);
+  return error;
+}
@@ -0,0 +1,34 @@
+// Copyright (c) 2016 Nuxi, https://nuxi.nl/
+//
+// This file is distributed under a 2-clause BSD license.
+// See the LICENSE file for details.
+
+#include <argdata.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "argdata_impl.h"
+
+int argdata_map_get_str(argdata_map_index_t *index, const char *key,
+                        const argdata_t **value) {
+  // Encode the key as a string, so that it can be compared against the
+  // keys of the map.
+  size_t keylen = strlen(key);
+  uint8_t tmp[256], *buf = tmp;
+  if (keylen + 2 > sizeof(tmp)) {
+    buf = malloc(keylen + 2);
+    if (buf == NULL)
+      return errno;
+  }
+  buf[0] = ADT_STR;
+  memcpy(buf + 1, key, keylen + 1);
+
+  argdata_t ad;
+  argdata_init_buffer(&ad, buf, keylen + 2);
+  int error = argdata_map_get(index, &ad, value);
+  if (buf != tmp)
+    free(buf);
+  return error;
+}
@@ -0,0 +1,50 @@
+// Copyright (c) 2016 Nuxi, https://nuxi.nl/
+//
+// This file is distributed under a 2-clause BSD license.
+// See the LICENSE file for details.
+
+#include <argdata.h>
+#include <errno.h>
+#include <stdalign.h>
+#include <stdint.h>
+
+#include "argdata_impl.h"
+
+int argdata_map_index(const argdata_t *ad, argdata_map_index_t *index_,
+                      void *storage, size_t storagelen) {
+  struct cloudabi_argdata_map_index *index =
+      (struct cloudabi_argdata_map_index *)index_;
+  index->container = ad;
+  index->state = INDEX_NONE;
+  index->slots = NULL;
+  index->nslots = 0;
+  switch (ad->type) {
+    case AD_BUFFER: {
+      const uint8_t *buf = ad->buffer;
+      size_t len = ad->length;
+      index->error = parse_type(ADT_MAP, &buf, &len);
+      if (index->error == 0 && storage != NULL) {
+        // Only use the storage once a lookup is performed, so that
+        // maps that are never searched are not scanned. The index needs
+        // at least two slots, so that it always contains an empty one.
+        const size_t align = alignof(struct cloudabi_argdata_map_index_slot);
+        size_t skip = -(uintptr_t)storage & (align - 1);
+        if (storagelen > skip &&
+            (storagelen - skip) / sizeof(index->slots[0]) >= 2) {
+          index->state = INDEX_PENDING;
+          index->slots = (struct cloudabi_argdata_map_index_slot *)(
+              (char *)storage + skip);
+          index->nslots = (storagelen - skip) / sizeof(index->slots[0]);
+        }
+      }
+      break;
+    }
+    case AD_MAP:
+      index->error = 0;
+      break;
+    default:
+      index->error = EINVAL;
+      break;
+  }
+  return index->error;
+}
@@ -0,0 +1,60 @@
+// Copyright (c) 2016 Nuxi, https://nuxi.nl/
+//
+// This file is distributed under a 2-clause BSD license.
+// See the LICENSE file for details.
+
+#include <argdata.h>
+#include <errno.h>
+#include <stdint.h>
+
+#include "argdata_impl.h"
+
+int argdata_seq_get(argdata_seq_index_t *index_, size_t i,
+                    const argdata_t **value) {
+  struct cloudabi_argdata_seq_index *index =
+      (struct cloudabi_argdata_seq_index *)index_;
+  if (index->error != 0)
+    return index->error;
+  const argdata_t *ad = index->container;
+  if (ad->type == AD_SEQ) {
+    if (i >= ad->seq.count)
+      return ENOENT;
+    *value = ad->seq.entries[i];
+    return 0;
+  }
+  if (index->length != SIZE_MAX && i >= index->length)
+    return index->tail_error != 0 ? index->tail_error : ENOENT;
+
+  // Start scanning at the closest preceding entry whose offset is
+  // known, either through the index or the cursor.
+  size_t start = 0, offset = 1;
+  if (index->offsets != NULL) {
+    start = i >> index->shift << index->shift;
+    offset = index->offsets[i >> index->shift];
+  }
+  if (index->cursor_index <= i && index->cursor_index > start) {
+    start = index->cursor_index;
+    offset = index->cursor_offset;
+  }
+
+  const uint8_t *buf = ad->buffer + offset;
+  size_t len = ad->length - offset;
+  for (;;) {
+    if (len == 0) {
+      index->length = start;
+      return ENOENT;
+    }
+    int error = parse_subfield(&index->value, &buf, &len);
+    if (error != 0) {
+      index->length = start;
+      index->tail_error = error;
+      return error;
+    }
+    if (start++ == i)
+      break;
+  }
+  index->cursor_index = start;
+  index->cursor_offset = buf - ad->buffer;
+  *value = &index->value;
+  return 0;
+}
@@ -0,0 +1,83 @@
+// Copyright (c) 2016 Nuxi, https://nuxi.nl/
+//
+// This file is distributed under a 2-clause BSD license.
+// See the LICENSE file for details.
+
+#include <argdata.h>
+#include <errno.h>
+#include <stdalign.h>
+#include <stdint.h>
+
+#include "argdata_impl.h"
+
+// Records the offsets of the entries of a sequence backed by a buffer.
+// When the storage provided is exhausted, every other offset is
+// discarded and the distance between recorded entries is doubled.
+static void build_index(struct cloudabi_argdata_seq_index *index,
+                        uint32_t *offsets, size_t noffsets) {
+  const argdata_t *ad = index->container;
+  const uint8_t *buf = ad->buffer + 1;
+  size_t len = ad->length - 1;
+  size_t count = 0;
+  unsigned int shift = 0;
+  while (len > 0) {
+    size_t offset = buf - ad->buffer;
+    argdata_t value;
+    int error = parse_subfield(&value, &buf, &len);
+    if (error != 0) {
+      index->tail_error = error;
+      break;
+    }
+
+    if ((count & (((size_t)1 << shift) - 1)) == 0) {
+      if (count >> shift == noffsets) {
+        for (size_t i = 0; 2 * i < noffsets; ++i)
+          offsets[i] = offsets[2 * i];
+        ++shift;
+      }
+      if ((count & (((size_t)1 << shift) - 1)) == 0)
+        offsets[count >> shift] = offset;
+    }
+    ++count;
+  }
+  index->offsets = offsets;
+  index->shift = shift;
+  index->length = count;
+}
+
+int argdata_seq_index(const argdata_t *ad, argdata_seq_index_t *index_,
+                      void *storage, size_t storagelen) {
+  struct cloudabi_argdata_seq_index *index =
+      (struct cloudabi_argdata_seq_index *)index_;
+  index->container = ad;
+  index->offsets = NULL;
+  index->shift = 0;
+  index->length = SIZE_MAX;
+  index->tail_error = 0;
+  switch (ad->type) {
+    case AD_BUFFER: {
+      const uint8_t *buf = ad->buffer;
+      size_t len = ad->length;
+      index->error = parse_type(ADT_SEQ, &buf, &len);
+      index->cursor_index = 0;
+      index->cursor_offset = buf - ad->buffer;
+      if (index->error == 0 && storage != NULL &&
+          ad->length <= UINT32_MAX) {
+        const size_t align = alignof(uint32_t);
+        size_t skip = -(uintptr_t)storage & (align - 1);
+        if (storagelen >= skip + sizeof(uint32_t))
+          build_index(index, (uint32_t *)((char *)storage + skip),
+                      (storagelen - skip) / sizeof(uint32_t));
+      }
+      break;
+    }
+    case AD_SEQ:
+      index->error = 0;
+      index->length = ad->seq.count;
+      break;
+    default:
+      index->error = EINVAL;
+      break;
+  }
+  return index->error;
+}
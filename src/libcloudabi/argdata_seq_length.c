@@ -0,0 +1,38 @@
+// Copyright (c) 2016 Nuxi, https://nuxi.nl/
+//
+// This file is distributed under a 2-clause BSD license.
+// See the LICENSE file for details.
+
+#include <argdata.h>
+#include <stdint.h>
+
+#include "argdata_impl.h"
+
+int argdata_seq_length(argdata_seq_index_t *index_, size_t *length) {
+  struct cloudabi_argdata_seq_index *index =
+      (struct cloudabi_argdata_seq_index *)index_;
+  if (index->error != 0)
+    return index->error;
+
+  if (index->length == SIZE_MAX) {
+    // Count the remaining entries, starting at the cursor.
+    const argdata_t *ad = index->container;
+    const uint8_t *buf = ad->buffer + index->cursor_offset;
+    size_t len = ad->length - index->cursor_offset;
+    size_t count = index->cursor_index;
+    while (len > 0) {
+      argdata_t value;
+      int error = parse_subfield(&value, &buf, &len);
+      if (error != 0) {
+        index->tail_error = error;
+        break;
+      }
+      ++count;
+    }
+    index->length = count;
+  }
+  if (index->tail_error != 0)
+    return index->tail_error;
+  *length = index->length;
+  return 0;
+}
@@ -6,6 +6,7 @@
 #include <argdata.h>
 #include <errno.h>
 #include <program.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -21,24 +22,30 @@ int program_exec(int fd, const argdata_t *ad) {
     return errno;
   }
 
-  // Encode data. Add a trailing null byte, as execve() uses null
-  // terminated strings.
+  // Encode data. The encoded data has a trailing null byte, as
+  // execve() uses null terminated strings.
+  void *buf;
   size_t datalen;
-  argdata_get_buffer_length(adseq, &datalen, NULL);
-  char data[datalen + 1];
-  argdata_get_buffer(adseq, data, NULL);
-  data[datalen] = '\0';
+  int error = argdata_encode(adseq, &buf, &datalen, NULL, NULL);
   argdata_free(adfd);
   argdata_free(adseq);
+  if (error != 0)
+    return error;
 
   // Data may contain null bytes. Split data up in multiple arguments,
   // so that all arguments concatenated (including the null bytes)
   // correspond to the original data.
+  char *data = buf;
   size_t argc = 0;
   for (size_t i = 0; i <= datalen; ++i)
     if (data[i] == '\0')
       ++argc;
-  char *argv[argc + 1];
+  char **argv = malloc((argc + 1) * sizeof(argv[0]));
+  if (argv == NULL) {
+    error = errno;
+    free(data);
+    return error;
+  }
   char *p = data;
   for (size_t i = 0; i < argc; ++i) {
     argv[i] = p;
@@ -57,5 +64,8 @@ int program_exec(int fd, const argdata_t *ad) {
   // sandboxed program. This also ensures that we're already in
   // capabilities mode before executing the program.
   execve(PATH_CLOUDABI_REEXEC, argv, &envp);
-  return errno;
+  error = errno;
+  free(argv);
+  free(data);
+  return error;
 }
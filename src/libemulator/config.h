@@ -54,12 +54,36 @@
 #define CONFIG_HAS_PDFORK 0
 #endif
 
+#ifdef __linux__
+#define CONFIG_HAS_FUTEX 1
+#else
+#define CONFIG_HAS_FUTEX 0
+#endif
+
+#ifdef __linux__
+#define CONFIG_HAS_EPOLL 1
+#else
+#define CONFIG_HAS_EPOLL 0
+#endif
+
 #if !defined(__APPLE__) && !defined(__FreeBSD__)
 #define CONFIG_HAS_FDATASYNC 1
 #else
 #define CONFIG_HAS_FDATASYNC 0
 #endif
 
+#ifdef __linux__
+#define CONFIG_HAS_GETDENTS64 1
+#else
+#define CONFIG_HAS_GETDENTS64 0
+#endif
+
+#ifdef __linux__
+#define CONFIG_HAS_GETRANDOM 1
+#else
+#define CONFIG_HAS_GETRANDOM 0
+#endif
+
 #ifndef __CloudABI__
 #define CONFIG_HAS_ISATTY 1
 #else
@@ -84,6 +108,12 @@
 #define CONFIG_HAS_KQUEUE 0
 #endif
 
+#ifdef __linux__
+#define CONFIG_HAS_OPENAT2 1
+#else
+#define CONFIG_HAS_OPENAT2 0
+#endif
+
 #ifndef __APPLE__
 #define CONFIG_HAS_POSIX_FALLOCATE 1
 #else
@@ -102,6 +132,12 @@
 #define CONFIG_HAS_PWRITEV 0
 #endif
 
+#ifdef __linux__
+#define CONFIG_HAS_SIGEV_THREAD_ID 1
+#else
+#define CONFIG_HAS_SIGEV_THREAD_ID 0
+#endif
+
 #ifdef __APPLE__
 #define st_atimespec st_atim
 #define st_mtimespec st_mtim
@@ -114,6 +150,12 @@
 #define CONFIG_HAS_STRLCPY 0
 #endif
 
+#ifdef __linux__
+#define CONFIG_HAS_VDSO_CLOCK_GETTIME 1
+#else
+#define CONFIG_HAS_VDSO_CLOCK_GETTIME 0
+#endif
+
 #ifdef __APPLE__
 #define CONFIG_TLS_USE_GSBASE 1
 #else
@@ -63,6 +63,24 @@ typedef struct {
 
 #define ELFOSABI_CLOUDABI 17
 
+typedef struct {
+  Elf64_Word sh_name;
+  Elf64_Word sh_type;
+  Elf64_Xword sh_flags;
+  Elf64_Addr sh_addr;
+  Elf64_Off sh_offset;
+  Elf64_Xword sh_size;
+  Elf64_Word sh_link;
+  Elf64_Word sh_info;
+  Elf64_Xword sh_addralign;
+  Elf64_Xword sh_entsize;
+} Elf64_Shdr;
+
+#define SHN_UNDEF 0
+
+#define SHT_SYMTAB 2
+#define SHT_DYNSYM 11
+
 #define STN_UNDEF 0
 
 typedef struct {
@@ -75,6 +93,7 @@ typedef struct {
 } Elf64_Sym;
 
 #define ELF64_ST_INFO(b, t) (((b) << 4) + ((t)&0xf))
+#define ELF64_ST_TYPE(i) ((i)&0xf)
 
 #define STB_GLOBAL 1
 
@@ -114,6 +133,7 @@ typedef struct {
 #define DT_SYMTAB 6
 #define DT_STRSZ 10
 #define DT_SYMENT 11
+#define DT_GNU_HASH 0x6ffffef5
 
 #define ElfW(type) Elf64_##type
 #define ELFW(type) ELF64_##type
@@ -11,11 +11,14 @@
 #include <sys/mman.h>
 
 #include <errno.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <cloudabi_syscalls_info.h>
@@ -24,9 +27,12 @@
 
 #include "elf.h"
 #include "emulate.h"
+#include "hostvdso.h"
 #include "posix.h"
+#include "profile.h"
 #include "random.h"
 #include "signals.h"
+#include "symbols.h"
 #include "tidpool.h"
 #include "tls.h"
 
@@ -54,6 +60,260 @@ static bool do_pread(int fd, void *buf, size_t len, off_t pos) {
   return true;
 }
 
+// Whether a perf map should be written for the executable.
+static bool perfmap_enabled = false;
+
+void emulate_set_perfmap(bool enabled) {
+  perfmap_enabled = enabled;
+}
+
+// Writes the function symbols of the executable to /tmp/perf-<pid>.map,
+// the format in which JIT compilers pass symbols to the perf profiler.
+// The executable is mapped at a random address, which perf would
+// otherwise be unable to attribute to the executable.
+static void perfmap_write(const struct symbols *symbols) {
+  char path[32];
+  snprintf(path, sizeof(path), "/tmp/perf-%ld.map", (long)getpid());
+  FILE *f = fopen(path, "w");
+  if (f == NULL)
+    return;
+  for (size_t i = 0; i < symbols->count; ++i) {
+    const struct symbol *symbol = &symbols->entries[i];
+    fprintf(f, "%" PRIxPTR " %zx %s\n", symbol->start, symbol->size,
+            symbol->name);
+  }
+  fclose(f);
+}
+
+// Stream to which profiling results should be written.
+static FILE *profile_out = NULL;
+
+void emulate_set_profile(FILE *out) {
+  profile_out = out;
+}
+
+// In-memory shared object that is provided to the application. This
+// shared object contains the system call functions that may be invoked.
+#define NSYSCALLS (sizeof(cloudabi_syscalls_t) / sizeof(void *))
+#define NBLOOM 4
+#define STRENT(x) \
+  "\0"            \
+  "cloudabi_sys_" #x
+#define STRTAB CLOUDABI_SYSCALL_NAMES(STRENT)
+static struct vdso {
+  ElfW(Ehdr) ehdr;
+  ElfW(Phdr) phdrs[1];
+  ElfW(Dyn) dyns[7];
+  struct {
+    Elf32_Word nbucket;
+    Elf32_Word nchain;
+    Elf32_Word buckets[NSYSCALLS];
+    Elf32_Word chains[NSYSCALLS + 1];
+  } hash;
+  struct {
+    Elf32_Word nbucket;
+    Elf32_Word symoffset;
+    Elf32_Word bloom_size;
+    Elf32_Word bloom_shift;
+    ElfW(Addr) bloom[NBLOOM];
+    Elf32_Word buckets[NSYSCALLS];
+    Elf32_Word chains[NSYSCALLS];
+  } gnu_hash;
+  char strtab[sizeof(STRTAB)];
+  ElfW(Sym) symtab[NSYSCALLS + 1];
+} vdso = {
+    .ehdr =
+        {
+            .e_ident =
+                {
+                        [EI_MAG0] = ELFMAG0, [EI_MAG1] = ELFMAG1,
+                        [EI_MAG2] = ELFMAG2, [EI_MAG3] = ELFMAG3,
+                        [EI_OSABI] = ELFOSABI_CLOUDABI,
+                },
+            .e_type = ET_DYN,
+            .e_version = EV_CURRENT,
+            .e_phoff = offsetof(struct vdso, phdrs),
+            .e_ehsize = sizeof(vdso.ehdr),
+            .e_phentsize = sizeof(vdso.phdrs[0]),
+            .e_phnum = sizeof(vdso.phdrs) / sizeof(vdso.phdrs[0]),
+        },
+    .phdrs =
+        {
+            {
+                .p_type = PT_DYNAMIC,
+                .p_flags = PF_R,
+                .p_offset = offsetof(struct vdso, dyns),
+                .p_vaddr = offsetof(struct vdso, dyns),
+                .p_filesz = sizeof(vdso.dyns),
+                .p_memsz = sizeof(vdso.dyns),
+                .p_align = _Alignof(ElfW(Dyn)),
+            },
+        },
+    .dyns =
+        {
+            {.d_tag = DT_HASH, .d_un.d_ptr = offsetof(struct vdso, hash)},
+            {.d_tag = DT_GNU_HASH,
+             .d_un.d_ptr = offsetof(struct vdso, gnu_hash)},
+            {.d_tag = DT_STRTAB, .d_un.d_ptr = offsetof(struct vdso, strtab)},
+            {.d_tag = DT_SYMTAB, .d_un.d_val = offsetof(struct vdso, symtab)},
+            {.d_tag = DT_STRSZ, .d_un.d_val = sizeof(vdso.strtab)},
+            {.d_tag = DT_SYMENT, .d_un.d_val = sizeof(vdso.symtab[0])},
+            {.d_tag = DT_NULL},
+        },
+    .hash = {.nbucket = NSYSCALLS, .nchain = NSYSCALLS + 1},
+    .gnu_hash =
+        {
+            .nbucket = NSYSCALLS,
+            .symoffset = 1,
+            .bloom_size = NBLOOM,
+            .bloom_shift = 6,
+        },
+    .strtab = STRTAB,
+};
+static bool vdso_initialized = false;
+
+// Hash function used by DT_HASH.
+static uint32_t vdso_hash(const char *name) {
+  uint32_t h = 0;
+  for (const unsigned char *s = (const unsigned char *)name; *s != '\0'; ++s) {
+    h = (h << 4) + *s;
+    h ^= (h >> 24) & 0xf0;
+  }
+  return h & 0x0fffffff;
+}
+
+// Hash function used by DT_GNU_HASH.
+static uint32_t vdso_gnu_hash(const char *name) {
+  uint32_t h = 5381;
+  for (const unsigned char *s = (const unsigned char *)name; *s != '\0'; ++s)
+    h = h * 33 + *s;
+  return h;
+}
+
+#if CONFIG_HAS_VDSO_CLOCK_GETTIME
+static int (*vdso_host_clock_gettime)(clockid_t, struct timespec *);
+
+// Implementation of clock_time_get() that reads the time through the
+// host's vDSO directly, without entering the emulator.
+static cloudabi_errno_t vdso_clock_time_get(cloudabi_clockid_t clock_id,
+                                            cloudabi_timestamp_t precision,
+                                            cloudabi_timestamp_t *time) {
+  clockid_t nclock_id;
+  switch (clock_id) {
+    case CLOUDABI_CLOCK_MONOTONIC:
+      nclock_id = CLOCK_MONOTONIC;
+      break;
+    case CLOUDABI_CLOCK_PROCESS_CPUTIME_ID:
+      nclock_id = CLOCK_PROCESS_CPUTIME_ID;
+      break;
+    case CLOUDABI_CLOCK_REALTIME:
+      nclock_id = CLOCK_REALTIME;
+      break;
+    case CLOUDABI_CLOCK_THREAD_CPUTIME_ID:
+      nclock_id = CLOCK_THREAD_CPUTIME_ID;
+      break;
+    default:
+      return CLOUDABI_EINVAL;
+  }
+
+  // The vDSO returns a negative error number instead of setting errno.
+  struct timespec ts;
+  if (vdso_host_clock_gettime(nclock_id, &ts) != 0)
+    return CLOUDABI_EINVAL;
+  if (ts.tv_sec < 0)
+    *time = 0;
+  else if (ts.tv_sec >= UINT64_MAX / 1000000000)
+    *time = UINT64_MAX;
+  else
+    *time = (cloudabi_timestamp_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+  return 0;
+}
+#endif
+
+// Returns the shared object, filling in its symbol and hash tables on
+// first use. Symbol lookups by the application's dynamic linker can use
+// either hash table, which both have one bucket per symbol. Symbol zero
+// is the undefined symbol. The others are sorted by their DT_GNU_HASH
+// bucket, as that format requires the chains to be contiguous.
+static struct vdso *vdso_get(const ElfW(Ehdr) * ehdr,
+                             const cloudabi_syscalls_t *forward) {
+  vdso.ehdr.e_machine = ehdr->e_machine;
+  vdso.ehdr.e_flags = ehdr->e_flags;
+  if (vdso_initialized)
+    return &vdso;
+
+  // Leaf system calls are invoked without switching TLS areas. This is
+  // only known to be safe for the POSIX implementation, as interposers
+  // like stats_syscalls depend on the TLS area of the host.
+  cloudabi_syscalls_t syscalls = tls_syscalls;
+  if (forward == &posix_syscalls) {
+    tls_syscalls_get(&syscalls, forward);
+#if CONFIG_HAS_VDSO_CLOCK_GETTIME
+    // Let clock_time_get() call into the host's vDSO directly.
+    vdso_host_clock_gettime = hostvdso_lookup(HOSTVDSO_CLOCK_GETTIME);
+    if (vdso_host_clock_gettime != NULL)
+      syscalls.clock_time_get = vdso_clock_time_get;
+#endif
+  }
+
+  // Compute the hashes of all symbol names.
+  struct {
+    uint32_t name;
+    uint32_t hash;
+    uint32_t gnu_hash;
+  } syms[NSYSCALLS];
+  size_t first[NSYSCALLS + 1] = {0};
+  size_t offset = 1;
+  for (size_t i = 0; i < NSYSCALLS; ++i) {
+    const char *name = vdso.strtab + offset;
+    syms[i].name = offset;
+    syms[i].hash = vdso_hash(name);
+    syms[i].gnu_hash = vdso_gnu_hash(name);
+    offset += strlen(name) + 1;
+    ++first[syms[i].gnu_hash % NSYSCALLS + 1];
+  }
+
+  // Determine the index of the first symbol in every bucket.
+  size_t next[NSYSCALLS];
+  first[0] = 1;
+  for (size_t i = 0; i < NSYSCALLS; ++i) {
+    first[i + 1] += first[i];
+    next[i] = first[i];
+    vdso.gnu_hash.buckets[i] = first[i] < first[i + 1] ? first[i] : STN_UNDEF;
+  }
+
+  // Fill the symbol table and the hash tables.
+  const size_t bloom_bits = sizeof(vdso.gnu_hash.bloom[0]) * 8;
+  for (size_t i = 0; i < NSYSCALLS; ++i) {
+    uint32_t gnu_hash = syms[i].gnu_hash;
+    size_t bucket = gnu_hash % NSYSCALLS;
+    size_t index = next[bucket]++;
+    ElfW(Sym) *sym = &vdso.symtab[index];
+    sym->st_name = syms[i].name;
+    sym->st_info = ELFW(ST_INFO)(STB_GLOBAL, STT_FUNC);
+    sym->st_other = STV_DEFAULT;
+    sym->st_value = ((const uintptr_t *)&syscalls)[i] - (uintptr_t)&vdso;
+
+    Elf32_Word *hash_bucket = &vdso.hash.buckets[syms[i].hash % NSYSCALLS];
+    vdso.hash.chains[index] = *hash_bucket;
+    *hash_bucket = index;
+
+    // The lowest bit of a chain entry marks the end of the bucket.
+    vdso.gnu_hash.chains[index - 1] =
+        (gnu_hash & ~1) | (index + 1 == first[bucket + 1]);
+    vdso.gnu_hash.bloom[gnu_hash / bloom_bits % NBLOOM] |=
+        (ElfW(Addr))1 << gnu_hash % bloom_bits |
+        (ElfW(Addr))1 << (gnu_hash >> vdso.gnu_hash.bloom_shift) % bloom_bits;
+  }
+  vdso_initialized = true;
+  return &vdso;
+}
+
+#undef STRTAB
+#undef STRENT
+#undef NBLOOM
+#undef NSYSCALLS
+
 void emulate(int fd, const void *argdata, size_t argdatalen,
              const cloudabi_syscalls_t *syscalls) {
   // Parse the ELF header.
@@ -150,83 +410,17 @@ void emulate(int fd, const void *argdata, size_t argdatalen,
     }
   }
 
-  // Create an in-memory shared object that is provided to the
-  // application. This shared object contains the system call functions
-  // that may be invoked.
-  struct vdso {
-    ElfW(Ehdr) ehdr;
-    ElfW(Phdr) phdrs[1];
-    ElfW(Dyn) dyns[6];
-#define NSYSCALLS (sizeof(*syscalls) / sizeof(void *))
-    struct {
-      Elf32_Word nbucket;
-      Elf32_Word nchain;
-      Elf32_Word buckets[1];
-      Elf32_Word chains[NSYSCALLS];
-    } hash;
-#define STRENT(x) \
-  "\0"            \
-  "cloudabi_sys_" #x
-#define STRTAB CLOUDABI_SYSCALL_NAMES(STRENT)
-    char strtab[sizeof(STRTAB)];
-    ElfW(Sym) symtab[NSYSCALLS];
-  } vdso = {
-      .ehdr =
-          {
-              .e_ident =
-                  {
-                          [EI_MAG0] = ELFMAG0, [EI_MAG1] = ELFMAG1,
-                          [EI_MAG2] = ELFMAG2, [EI_MAG3] = ELFMAG3,
-                          [EI_OSABI] = ELFOSABI_CLOUDABI,
-                  },
-              .e_type = ET_DYN,
-              .e_machine = ehdr.e_machine,
-              .e_version = EV_CURRENT,
-              .e_phoff = offsetof(struct vdso, phdrs),
-              .e_flags = ehdr.e_flags,
-              .e_ehsize = sizeof(vdso.ehdr),
-              .e_phentsize = sizeof(vdso.phdrs[0]),
-              .e_phnum = sizeof(vdso.phdrs) / sizeof(vdso.phdrs[0]),
-          },
-      .phdrs =
-          {
-              {
-                  .p_type = PT_DYNAMIC,
-                  .p_flags = PF_R,
-                  .p_offset = offsetof(struct vdso, dyns),
-                  .p_vaddr = offsetof(struct vdso, dyns),
-                  .p_filesz = sizeof(vdso.dyns),
-                  .p_memsz = sizeof(vdso.dyns),
-                  .p_align = _Alignof(ElfW(Dyn)),
-              },
-          },
-      .dyns =
-          {
-              {.d_tag = DT_HASH, .d_un.d_ptr = offsetof(struct vdso, hash)},
-              {.d_tag = DT_STRTAB, .d_un.d_ptr = offsetof(struct vdso, strtab)},
-              {.d_tag = DT_SYMTAB, .d_un.d_val = offsetof(struct vdso, symtab)},
-              {.d_tag = DT_STRSZ, .d_un.d_val = sizeof(vdso.strtab)},
-              {.d_tag = DT_SYMENT, .d_un.d_val = sizeof(vdso.symtab[0])},
-              {.d_tag = DT_NULL},
-          },
-      .hash = {.nbucket = 1, .nchain = NSYSCALLS, .buckets = {0}},
-      .strtab = STRTAB,
-  };
-
-  // Fill the symbol table and symbol hash table.
-  size_t offset = 1;
-  for (size_t i = 0; i < NSYSCALLS; ++i) {
-    vdso.hash.chains[i] = i + 1 < NSYSCALLS ? i + 1 : STN_UNDEF;
-    ElfW(Sym) *sym = &vdso.symtab[i];
-    sym->st_name = offset;
-    offset += strlen(vdso.strtab + offset) + 1;
-    sym->st_info = ELFW(ST_INFO)(STB_GLOBAL, STT_FUNC);
-    sym->st_other = STV_DEFAULT;
-    sym->st_value = ((const uintptr_t *)&tls_syscalls)[i] - (uintptr_t)&vdso;
+  // Let profilers symbolize code of the executable.
+  static struct symbols symbols;
+  if (perfmap_enabled || profile_out != NULL) {
+    if (!symbols_load(&symbols, fd, &ehdr, base))
+      return;
+    if (perfmap_enabled)
+      perfmap_write(&symbols);
   }
 
-#undef STRTAB
-#undef NSYSCALLS
+  // Provide the system call functions through a shared object.
+  struct vdso *vdso = vdso_get(&ehdr, syscalls);
 
   // Create an auxiliary vector containing the parameters that need to
   // be passed to the executable.
@@ -243,7 +437,7 @@ void emulate(int fd, const void *argdata, size_t argdatalen,
       {.a_type = CLOUDABI_AT_PAGESZ, .a_val = pagesize},
       {.a_type = CLOUDABI_AT_PHDR, .a_ptr = base + ehdr.e_phoff},
       {.a_type = CLOUDABI_AT_PHNUM, .a_val = ehdr.e_phnum},
-      {.a_type = CLOUDABI_AT_SYSINFO_EHDR, .a_ptr = &vdso},
+      {.a_type = CLOUDABI_AT_SYSINFO_EHDR, .a_ptr = vdso},
       {.a_type = CLOUDABI_AT_TID, .a_val = tid},
       {.a_type = CLOUDABI_AT_NULL},
   };
@@ -251,6 +445,12 @@ void emulate(int fd, const void *argdata, size_t argdatalen,
   // Reset signals to their default behaviour.
   signals_init();
 
+  // Start sampling the call stacks of the executable.
+  if (profile_out != NULL &&
+      !profile_start(profile_out, &symbols, (uintptr_t)base + addr_begin,
+                     (uintptr_t)base + addr_end))
+    return;
+
 #if CONFIG_HAS_CAP_ENTER
   // Make use of the host system's support for Capsicum. By enabling
   // this, there is no need to emulate any of the directory sandboxing
@@ -6,8 +6,20 @@
 #ifndef EMULATE_H
 #define EMULATE_H
 
+#include <stdbool.h>
+#include <stdio.h>
+
 #include <cloudabi_syscalls_struct.h>
 
 void emulate(int, const void *, size_t, const cloudabi_syscalls_t *);
 
+// Sets whether emulate() should write a perf map for the executable,
+// so that profilers like perf can symbolize code of the executable.
+void emulate_set_perfmap(bool);
+
+// Sets the stream to which emulate() should write the call stacks of
+// the executable, obtained through sampling. Profiling is disabled if
+// no stream is provided.
+void emulate_set_profile(FILE *);
+
 #endif
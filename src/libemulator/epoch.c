@@ -0,0 +1,166 @@
+// Copyright (c) 2016 Nuxi, https://nuxi.nl/
+//
+// This file is distributed under a 2-clause BSD license.
+// See the LICENSE file for details.
+
+#include <assert.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "epoch.h"
+#include "locking.h"
+
+// Per-thread reader state. Records are never freed, but are recycled
+// once the thread owning them has terminated. They are cache line
+// aligned, as readers write to them on every section.
+struct epoch_record {
+  alignas(64) _Atomic(uint64_t) er_active;  // Epoch entered, or zero.
+  _Atomic(bool) er_used;                    // Owned by a thread.
+  struct epoch_record *er_next;             // Next record in the list.
+};
+
+// Global epoch counter. Zero is reserved for quiescent readers.
+static _Atomic(uint64_t) epoch_global = 1;
+
+// List of all reader records. Records are only ever prepended.
+static _Atomic(struct epoch_record *) epoch_records = NULL;
+static _Thread_local struct epoch_record *epoch_self = NULL;
+
+// Objects that have been retired, sorted by epoch.
+static struct mutex epoch_limbo_lock = MUTEX_INITIALIZER;
+static struct epoch_entry *epoch_limbo_head = NULL;
+static struct epoch_entry **epoch_limbo_tail = &epoch_limbo_head;
+
+// Returns the reader record of the calling thread, allocating one if
+// needed.
+static struct epoch_record *epoch_record_get(void) {
+  struct epoch_record *er = epoch_self;
+  if (er != NULL)
+    return er;
+
+  // Recycle a record of a thread that has terminated.
+  for (er = atomic_load_explicit(&epoch_records, memory_order_acquire);
+       er != NULL; er = er->er_next) {
+    bool used = false;
+    if (!atomic_load_explicit(&er->er_used, memory_order_relaxed) &&
+        atomic_compare_exchange_strong_explicit(&er->er_used, &used, true,
+                                                memory_order_acquire,
+                                                memory_order_relaxed)) {
+      epoch_self = er;
+      return er;
+    }
+  }
+
+  // Allocate a new record and prepend it to the list.
+  void *p;
+  if (posix_memalign(&p, alignof(struct epoch_record), sizeof(*er)) != 0)
+    return NULL;
+  er = p;
+  atomic_init(&er->er_active, 0);
+  atomic_init(&er->er_used, true);
+  er->er_next = atomic_load_explicit(&epoch_records, memory_order_relaxed);
+  while (!atomic_compare_exchange_weak_explicit(&epoch_records, &er->er_next,
+                                                er, memory_order_release,
+                                                memory_order_relaxed))
+    ;
+  epoch_self = er;
+  return er;
+}
+
+// Returns the oldest epoch in which a reader is still active.
+static uint64_t epoch_oldest(void) {
+  uint64_t oldest = UINT64_MAX;
+  for (struct epoch_record *er =
+           atomic_load_explicit(&epoch_records, memory_order_acquire);
+       er != NULL; er = er->er_next) {
+    uint64_t active =
+        atomic_load_explicit(&er->er_active, memory_order_acquire);
+    if (active != 0 && active < oldest)
+      oldest = active;
+  }
+  return oldest;
+}
+
+bool epoch_enter(void) {
+  struct epoch_record *er = epoch_record_get();
+  if (er == NULL)
+    return false;
+  assert(atomic_load_explicit(&er->er_active, memory_order_relaxed) == 0 &&
+         "Epoch sections cannot be nested");
+
+  // Publish the epoch before loading any shared pointers. Paired with
+  // the fence in epoch_retire(), this guarantees that either we observe
+  // an object being unlinked, or the writer observes us.
+  atomic_store_explicit(
+      &er->er_active,
+      atomic_load_explicit(&epoch_global, memory_order_acquire),
+      memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  return true;
+}
+
+void epoch_exit(void) {
+  atomic_store_explicit(&epoch_self->er_active, 0, memory_order_release);
+}
+
+void epoch_retire(struct epoch_entry *ee,
+                  void (*destructor)(struct epoch_entry *)) {
+  assert((epoch_self == NULL ||
+          atomic_load_explicit(&epoch_self->er_active,
+                               memory_order_relaxed) == 0) &&
+         "Cannot retire objects inside an epoch section");
+  ee->ee_free = destructor;
+  ee->ee_next = NULL;
+  mutex_lock(&epoch_limbo_lock);
+
+  // Readers that entered before this point may still reference the
+  // object. Readers that enter afterwards observe a newer epoch.
+  ee->ee_epoch =
+      atomic_fetch_add_explicit(&epoch_global, 1, memory_order_seq_cst);
+  atomic_thread_fence(memory_order_seq_cst);
+  *epoch_limbo_tail = ee;
+  epoch_limbo_tail = &ee->ee_next;
+
+  // Detach all objects that can no longer be referenced.
+  uint64_t oldest = epoch_oldest();
+  struct epoch_entry *reclaim = epoch_limbo_head;
+  struct epoch_entry **last = &reclaim;
+  while (*last != NULL && (*last)->ee_epoch < oldest)
+    last = &(*last)->ee_next;
+  epoch_limbo_head = *last;
+  if (epoch_limbo_head == NULL)
+    epoch_limbo_tail = &epoch_limbo_head;
+  *last = NULL;
+  mutex_unlock(&epoch_limbo_lock);
+
+  while (reclaim != NULL) {
+    struct epoch_entry *next = reclaim->ee_next;
+    reclaim->ee_free(reclaim);
+    reclaim = next;
+  }
+}
+
+void epoch_thread_exit(void) {
+  struct epoch_record *er = epoch_self;
+  if (er != NULL) {
+    epoch_self = NULL;
+    atomic_store_explicit(&er->er_used, false, memory_order_release);
+  }
+}
+
+void epoch_postfork(void) {
+  // Only the calling thread survives forking. Release the records of
+  // all other threads, as they will never leave their sections.
+  mutex_init(&epoch_limbo_lock);
+  for (struct epoch_record *er =
+           atomic_load_explicit(&epoch_records, memory_order_relaxed);
+       er != NULL; er = er->er_next) {
+    if (er != epoch_self) {
+      atomic_store_explicit(&er->er_active, 0, memory_order_relaxed);
+      atomic_store_explicit(&er->er_used, false, memory_order_relaxed);
+    }
+  }
+}
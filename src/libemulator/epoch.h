@@ -0,0 +1,44 @@
+// Copyright (c) 2016 Nuxi, https://nuxi.nl/
+//
+// This file is distributed under a 2-clause BSD license.
+// See the LICENSE file for details.
+
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Epoch-based memory reclamation.
+//
+// Readers bracket lock-free accesses to shared data structures with
+// epoch_enter() and epoch_exit(). Writers that unlink an object from
+// such a data structure pass it to epoch_retire(), which only frees it
+// once every reader that could still observe it has left its section.
+
+// Bookkeeping for a retired object. Embedded into the object itself, so
+// that retiring objects requires no allocations.
+struct epoch_entry {
+  void (*ee_free)(struct epoch_entry *);  // Destructor of the object.
+  uint64_t ee_epoch;                      // Epoch in which it was retired.
+  struct epoch_entry *ee_next;            // Next retired object.
+};
+
+// Enters a read-side section. Sections may not be nested. Returns
+// false if no reader state could be allocated for the calling thread.
+bool epoch_enter(void);
+
+// Leaves a read-side section.
+void epoch_exit(void);
+
+// Invokes the destructor of an unlinked object once no readers can
+// reference it anymore.
+void epoch_retire(struct epoch_entry *, void (*)(struct epoch_entry *));
+
+// Should be invoked by threads before they terminate.
+void epoch_thread_exit(void);
+
+// Should be invoked after forking, to reset the reader state.
+void epoch_postfork(void);
+
+#endif
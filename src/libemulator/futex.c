@@ -3,10 +3,22 @@
 // This file is distributed under a 2-clause BSD license.
 // See the LICENSE file for details.
 
+#include "config.h"
+
+#if CONFIG_HAS_FUTEX
+#include <sys/syscall.h>
+
+#include <linux/futex.h>
+#endif
+
 #include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdalign.h>
 #include <stdatomic.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <cloudabi_types.h>
@@ -22,9 +34,17 @@ struct futex_queue {
 };
 
 // Condition variables.
+//
+// The address and lock of a condition variable are immutable. Its
+// position in the hash table and fc_waitcount are protected by the lock
+// of the condition variable's bucket. The wait queue is protected by
+// the bucket lock of the associated lock, as waiters may be requeued
+// from the condition variable to the lock.
 struct futex_condvar {
   // Address of the condition variable.
   _Atomic(cloudabi_condvar_t) * fc_address;
+  // Hash table bucket in which this condition variable is stored.
+  struct futex_condvar_bucket *fc_bucket;
   // The lock the waiters should be moved to when signalled.
   struct futex_lock *fc_lock;
   // Threads waiting on the condition variable.
@@ -32,7 +52,7 @@ struct futex_condvar {
   // Number of threads blocked on this condition variable, or being
   // blocked on the lock after being requeued.
   unsigned int fc_waitcount;
-  // Global list pointers.
+  // Bucket list pointers.
   LIST_ENTRY(futex_condvar) fc_next;
 };
 
@@ -40,6 +60,8 @@ struct futex_condvar {
 struct futex_lock {
   // Address of the lock.
   _Atomic(cloudabi_lock_t) * fl_address;
+  // Hash table bucket in which this lock is stored.
+  struct futex_lock_bucket *fl_bucket;
   // Current owner of the lock. LOCK_UNMANAGED if the lock is currently
   // not owned by the kernel. LOCK_OWNER_UNKNOWN in case the owner is
   // not known (e.g., when the lock is read-locked).
@@ -52,95 +74,271 @@ struct futex_lock {
   struct futex_queue fl_readers;
   // Number of threads blocked on this lock + condition variables.
   unsigned int fl_waitcount;
-  // Global list pointers.
+  // Bucket list pointers.
   LIST_ENTRY(futex_lock) fl_next;
 };
 
 struct futex_waiter {
   // Thread ID.
   cloudabi_tid_t fw_tid;
+  // Hook used for waiting, if also waiting on other events.
+  const struct futex_poll_hook *fw_hook;
+#if CONFIG_HAS_FUTEX
+  // Futex word used for waiting. Set to one when the thread is woken up.
+  _Atomic(uint32_t) fw_wakeup;
+#else
   // Condition variable used for waiting.
   struct cond fw_wait;
+#endif
   // Queue this waiter is currently placed in.
   struct futex_queue *fw_queue;
   // List pointers of fw_queue.
   TAILQ_ENTRY(futex_waiter) fw_next;
 };
 
-// Global data structures.
-static struct mutex futex_global_lock = MUTEX_INITIALIZER;
-#define REQUIRES_FUTEX_LOCK REQUIRES_EXCLUSIVE(futex_global_lock)
+// Hash tables of locks and condition variables, keyed by address.
+//
+// Each bucket has its own lock, so that operations on unrelated locks
+// and condition variables do not contend. Locks and condition
+// variables are stored in separate tables. When both a condition
+// variable bucket and a lock bucket need to be held, the condition
+// variable bucket must always be acquired first.
+#define FUTEX_NBUCKETS_LOG2 8
+#define FUTEX_NBUCKETS (1 << FUTEX_NBUCKETS_LOG2)
+
+struct futex_lock_bucket {
+  alignas(64) struct mutex flb_lock;
+  LIST_HEAD(, futex_lock) flb_list;
+};
 
-static LIST_HEAD(, futex_lock)
-    futex_lock_list = LIST_HEAD_INITIALIZER(&futex_lock_list);
-static LIST_HEAD(, futex_condvar)
-    futex_condvar_list = LIST_HEAD_INITIALIZER(&futex_condvar_list);
+struct futex_condvar_bucket {
+  alignas(64) struct mutex fcb_lock;
+  LIST_HEAD(, futex_condvar) fcb_list;
+};
+
+static struct futex_lock_bucket futex_lock_table[FUTEX_NBUCKETS];
+static struct futex_condvar_bucket futex_condvar_table[FUTEX_NBUCKETS];
+static pthread_once_t futex_table_once = PTHREAD_ONCE_INIT;
+
+// Adaptive spinning.
+//
+// Before blocking on a lock, threads first spin for a short amount of
+// time, attempting to acquire the lock without involving the emulator.
+// This prevents two context switches per handoff for locks that are
+// only held briefly. The number of iterations is bounded by
+// futex_spin_limit and adjusted per thread, based on how many
+// iterations were needed to acquire locks previously. Spinning is
+// pointless on uniprocessor systems, as the owner of the lock cannot
+// make progress while we spin.
+static _Atomic(unsigned int) futex_spin_limit = 100;
+static bool futex_spin_multiprocessor;
+static _Thread_local unsigned int futex_spin_average;
+
+// Number of threads blocked on locks and condition variables.
+static _Atomic(unsigned int) futex_waiters = 0;
+
+#define REQUIRES_BUCKET_LOCK(fl) REQUIRES_EXCLUSIVE((fl)->fl_bucket->flb_lock)
 
 // Utility functions.
-static void futex_lock_assert(const struct futex_lock *) REQUIRES_FUTEX_LOCK;
-static struct futex_lock *futex_lock_lookup_locked(_Atomic(cloudabi_lock_t) *)
-    REQUIRES_FUTEX_LOCK;
+static void futex_lock_assert(const struct futex_lock *fl)
+    REQUIRES_BUCKET_LOCK(fl);
+static struct futex_lock *futex_lock_lookup_locked(
+    struct futex_lock_bucket *flb, _Atomic(cloudabi_lock_t) *)
+    REQUIRES_EXCLUSIVE(flb->flb_lock);
 static void futex_lock_release(struct futex_lock *fl)
-    UNLOCKS(futex_global_lock);
-static cloudabi_errno_t futex_lock_tryrdlock(struct futex_lock *)
-    REQUIRES_FUTEX_LOCK;
-static void futex_lock_unmanage(struct futex_lock *) REQUIRES_FUTEX_LOCK;
-static void futex_lock_update_owner(struct futex_lock *) REQUIRES_FUTEX_LOCK;
-static void futex_lock_wake_up_next(struct futex_lock *) REQUIRES_FUTEX_LOCK;
-static unsigned int futex_queue_count(const struct futex_queue *)
-    REQUIRES_FUTEX_LOCK;
-static void futex_queue_init(struct futex_queue *) REQUIRES_FUTEX_LOCK;
+    UNLOCKS(fl->fl_bucket->flb_lock);
+static cloudabi_errno_t futex_lock_tryrdlock(struct futex_lock *fl)
+    REQUIRES_BUCKET_LOCK(fl);
+static void futex_lock_unmanage(struct futex_lock *fl)
+    REQUIRES_BUCKET_LOCK(fl);
+static void futex_lock_update_owner(struct futex_lock *fl)
+    REQUIRES_BUCKET_LOCK(fl);
+static void futex_lock_wake_up_next(struct futex_lock *fl)
+    REQUIRES_BUCKET_LOCK(fl);
+static unsigned int futex_queue_count(const struct futex_queue *);
+static void futex_queue_init(struct futex_queue *);
 static void futex_queue_requeue(struct futex_queue *, struct futex_queue *,
-                                unsigned int) REQUIRES_FUTEX_LOCK;
+                                unsigned int);
 static cloudabi_errno_t futex_queue_sleep(
-    struct futex_queue *, struct futex_lock *, cloudabi_tid_t,
-    cloudabi_clockid_t, cloudabi_timestamp_t) REQUIRES_FUTEX_LOCK;
-static cloudabi_tid_t futex_queue_tid_best(const struct futex_queue *)
-    REQUIRES_FUTEX_LOCK;
-static void futex_queue_wake_up_all(struct futex_queue *) REQUIRES_FUTEX_LOCK;
-static void futex_queue_wake_up_best(struct futex_queue *) REQUIRES_FUTEX_LOCK;
+    struct futex_queue *, struct futex_lock *fl, cloudabi_tid_t,
+    cloudabi_clockid_t, cloudabi_timestamp_t, const struct futex_poll_hook *)
+    REQUIRES_BUCKET_LOCK(fl);
+static cloudabi_tid_t futex_queue_tid_best(const struct futex_queue *);
+static void futex_queue_wake_up_all(struct futex_queue *);
+static void futex_queue_wake_up_best(struct futex_queue *);
+static bool futex_waiter_sleep(struct futex_waiter *, struct futex_lock *fl,
+                               cloudabi_clockid_t, cloudabi_timestamp_t)
+    REQUIRES_BUCKET_LOCK(fl);
+static void futex_waiter_wake_up(struct futex_waiter *);
+
+// Hash table operations.
+
+static void futex_table_init(void) {
+  for (size_t i = 0; i < FUTEX_NBUCKETS; ++i) {
+    mutex_init(&futex_lock_table[i].flb_lock);
+    LIST_INIT(&futex_lock_table[i].flb_list);
+    mutex_init(&futex_condvar_table[i].fcb_lock);
+    LIST_INIT(&futex_condvar_table[i].fcb_list);
+  }
+  futex_spin_multiprocessor = sysconf(_SC_NPROCESSORS_ONLN) > 1;
+}
+
+// Computes the bucket index for an address using Fibonacci hashing.
+// The multiplication ensures that the low bits of the address, which
+// are mostly identical due to alignment, don't end up being ignored.
+static size_t futex_table_hash(const void *address) {
+  return ((uint64_t)(uintptr_t)address * UINT64_C(0x9e3779b97f4a7c15)) >>
+         (64 - FUTEX_NBUCKETS_LOG2);
+}
+
+static struct futex_condvar_bucket *futex_condvar_bucket(
+    const _Atomic(cloudabi_condvar_t) * address) {
+  pthread_once(&futex_table_once, futex_table_init);
+  return &futex_condvar_table[futex_table_hash(address)];
+}
+
+static struct futex_lock_bucket *futex_lock_bucket(
+    const _Atomic(cloudabi_lock_t) * address) {
+  pthread_once(&futex_table_once, futex_table_init);
+  return &futex_lock_table[futex_table_hash(address)];
+}
+
+// Spinning operations.
+
+// Busy-waits for a number of iterations, hinting the CPU that the
+// thread is spinning.
+static void futex_spin_pause(unsigned int iterations) {
+  while (iterations-- > 0) {
+#if defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ volatile("yield");
+#else
+    atomic_signal_fence(memory_order_seq_cst);
+#endif
+  }
+}
+
+// Updates the running average of iterations needed to acquire a lock.
+static void futex_spin_update_average(unsigned int iterations) {
+  futex_spin_average += ((int)iterations - (int)futex_spin_average) / 8;
+}
+
+// Attempts to acquire a lock by spinning on its userspace value, prior
+// to sleeping. Returns true if the lock got acquired.
+static bool futex_spin_lock(_Atomic(cloudabi_lock_t) * lock,
+                            cloudabi_tid_t tid, bool write) {
+  pthread_once(&futex_table_once, futex_table_init);
+  if (!futex_spin_multiprocessor)
+    return false;
+  unsigned int limit =
+      atomic_load_explicit(&futex_spin_limit, memory_order_relaxed);
+  if (limit > futex_spin_average * 2 + 10)
+    limit = futex_spin_average * 2 + 10;
+
+  cloudabi_lock_t old = atomic_load_explicit(lock, memory_order_relaxed);
+  cloudabi_lock_t owner = CLOUDABI_LOCK_UNLOCKED;
+  unsigned int backoff = 1;
+  for (unsigned int i = 0; i < limit; ++i) {
+    // Don't attempt to overtake threads that are already sleeping, as
+    // ownership of the lock is handed over to them directly.
+    if ((old & CLOUDABI_LOCK_KERNEL_MANAGED) != 0)
+      break;
+
+    if ((old & CLOUDABI_LOCK_WRLOCKED) == 0) {
+      // Lock is unlocked or read-locked.
+      if (write) {
+        if (old == CLOUDABI_LOCK_UNLOCKED &&
+            atomic_compare_exchange_weak(lock, &old,
+                                         tid | CLOUDABI_LOCK_WRLOCKED)) {
+          futex_spin_update_average(i);
+          return true;
+        }
+      } else {
+        if (atomic_compare_exchange_weak(lock, &old, old + 1)) {
+          futex_spin_update_average(i);
+          return true;
+        }
+      }
+    } else {
+      // Lock is write-locked. Let the slow path deal with recursive
+      // locking. If the lock got handed over to another thread while
+      // spinning, the lock is contended and the new owner has only
+      // just started its critical section. Stop spinning.
+      if ((old & ~CLOUDABI_LOCK_WRLOCKED) == tid ||
+          (owner != CLOUDABI_LOCK_UNLOCKED && owner != old))
+        break;
+      owner = old;
+    }
+
+    futex_spin_pause(backoff);
+    if (backoff < 64)
+      backoff *= 2;
+    old = atomic_load_explicit(lock, memory_order_relaxed);
+  }
+  futex_spin_update_average(limit);
+  return false;
+}
+
+// Sets the maximum number of iterations a thread may spin on a lock
+// before going to sleep. Spinning is disabled when set to zero.
+void futex_set_spin_limit(unsigned int limit) {
+  atomic_store_explicit(&futex_spin_limit, limit, memory_order_relaxed);
+}
 
 // futex_condvar operations.
 
 static void futex_condvar_assert(const struct futex_condvar *fc)
-    REQUIRES_FUTEX_LOCK {
+    REQUIRES_EXCLUSIVE(fc->fc_bucket->fcb_lock)
+        REQUIRES_BUCKET_LOCK(fc->fc_lock) {
   assert(fc->fc_waitcount >= futex_queue_count(&fc->fc_waiters) &&
          "Total number of waiters cannot be smaller than the wait queue");
   futex_lock_assert(fc->fc_lock);
 }
 
+// Looks up an existing condition variable object. Upon success, both
+// the bucket lock of the condition variable and the bucket lock of
+// its associated lock are held.
 static bool futex_condvar_lookup(const _Atomic(cloudabi_condvar_t) * address,
-                                 struct futex_condvar **fcret)
-    TRYLOCKS_EXCLUSIVE(true, futex_global_lock) {
-  mutex_lock(&futex_global_lock);
+                                 struct futex_condvar **fcret) NO_LOCK_ANALYSIS {
+  struct futex_condvar_bucket *fcb = futex_condvar_bucket(address);
+  mutex_lock(&fcb->fcb_lock);
   struct futex_condvar *fc;
-  LIST_FOREACH(fc, &futex_condvar_list, fc_next) {
+  LIST_FOREACH(fc, &fcb->fcb_list, fc_next) {
     if (fc->fc_address == address) {
+      // The lock cannot go away, as the condition variable holds a
+      // reference to it.
+      mutex_lock(&fc->fc_lock->fl_bucket->flb_lock);
       futex_condvar_assert(fc);
       *fcret = fc;
       return true;
     }
   }
-  mutex_unlock(&futex_global_lock);
+  mutex_unlock(&fcb->fcb_lock);
   return false;
 }
 
+// Looks up a condition variable object, creating it if needed. Upon
+// success, both the bucket lock of the condition variable and the
+// bucket lock of its associated lock are held.
 static cloudabi_errno_t futex_condvar_lookup_or_create(
     _Atomic(cloudabi_condvar_t) * condvar, _Atomic(cloudabi_lock_t) * lock,
-    struct futex_condvar **fcret) TRYLOCKS_EXCLUSIVE(0, futex_global_lock) {
-  mutex_lock(&futex_global_lock);
+    struct futex_condvar **fcret) NO_LOCK_ANALYSIS {
+  struct futex_condvar_bucket *fcb = futex_condvar_bucket(condvar);
+  mutex_lock(&fcb->fcb_lock);
   struct futex_condvar *fc;
-  LIST_FOREACH(fc, &futex_condvar_list, fc_next) {
+  LIST_FOREACH(fc, &fcb->fcb_list, fc_next) {
     if (fc->fc_address != condvar)
       continue;
     struct futex_lock *fl = fc->fc_lock;
     if (fl->fl_address != lock) {
       // Condition variable is owned by a different lock.
-      mutex_unlock(&futex_global_lock);
+      mutex_unlock(&fcb->fcb_lock);
       return CLOUDABI_EINVAL;
     }
 
     // Found fully matching condition variable.
+    mutex_lock(&fl->fl_bucket->flb_lock);
     futex_condvar_assert(fc);
     *fcret = fc;
     return 0;
@@ -149,37 +347,59 @@ static cloudabi_errno_t futex_condvar_lookup_or_create(
   // None found. Create new condition variable object.
   fc = malloc(sizeof(*fc));
   if (fc == NULL) {
-    mutex_unlock(&futex_global_lock);
+    mutex_unlock(&fcb->fcb_lock);
     return CLOUDABI_ENOMEM;
   }
+  struct futex_lock_bucket *flb = futex_lock_bucket(lock);
+  mutex_lock(&flb->flb_lock);
   fc->fc_address = condvar;
-  fc->fc_lock = futex_lock_lookup_locked(lock);
+  fc->fc_bucket = fcb;
+  fc->fc_lock = futex_lock_lookup_locked(flb, lock);
   if (fc->fc_lock == NULL) {
     free(fc);
-    mutex_unlock(&futex_global_lock);
+    mutex_unlock(&flb->flb_lock);
+    mutex_unlock(&fcb->fcb_lock);
     return CLOUDABI_ENOMEM;
   }
   futex_queue_init(&fc->fc_waiters);
   fc->fc_waitcount = 0;
-  LIST_INSERT_HEAD(&futex_condvar_list, fc, fc_next);
+  LIST_INSERT_HEAD(&fcb->fcb_list, fc, fc_next);
   *fcret = fc;
   return 0;
 }
 
-static void futex_condvar_release(struct futex_condvar *fc)
-    UNLOCKS(futex_global_lock) {
-  futex_condvar_assert(fc);
+// Drops the bucket locks acquired by futex_condvar_lookup().
+static void futex_condvar_unlock(struct futex_condvar *fc) NO_LOCK_ANALYSIS {
+  mutex_unlock(&fc->fc_lock->fl_bucket->flb_lock);
+  mutex_unlock(&fc->fc_bucket->fcb_lock);
+}
+
+// Drops a reference to a condition variable and its lock that was
+// acquired by futex_op_condvar_wait(), deallocating them if they are
+// no longer referenced. Only the bucket lock of the lock needs to be
+// held when called, but the bucket lock of the condition variable
+// needs to be acquired to adjust its reference count.
+static void futex_condvar_release(struct futex_condvar *fc) NO_LOCK_ANALYSIS {
   struct futex_lock *fl = fc->fc_lock;
-  if (fc->fc_waitcount == 0) {
+  struct futex_lock_bucket *flb = fl->fl_bucket;
+  struct futex_condvar_bucket *fcb = fc->fc_bucket;
+  mutex_unlock(&flb->flb_lock);
+  mutex_lock(&fcb->fcb_lock);
+  mutex_lock(&flb->flb_lock);
+
+  futex_condvar_assert(fc);
+  --fl->fl_waitcount;
+  if (--fc->fc_waitcount == 0) {
     // Condition variable has no waiters. Deallocate it.
     LIST_REMOVE(fc, fc_next);
     free(fc);
   }
+  mutex_unlock(&fcb->fcb_lock);
   futex_lock_release(fl);
 }
 
 static void futex_condvar_unmanage(struct futex_condvar *fc)
-    REQUIRES_FUTEX_LOCK {
+    REQUIRES_BUCKET_LOCK(fc->fc_lock) {
   if (futex_queue_count(&fc->fc_waiters) == 0)
     atomic_store(fc->fc_address, CLOUDABI_CONDVAR_HAS_NO_WAITERS);
 }
@@ -197,22 +417,24 @@ static void futex_lock_assert(const struct futex_lock *fl) {
          "Lock with no waiters must be unmanaged");
 }
 
+// Looks up a lock object, creating it if needed. Upon success, the
+// bucket lock of the lock is held.
 static bool futex_lock_lookup(_Atomic(cloudabi_lock_t) * lock,
-                              struct futex_lock **fl)
-    TRYLOCKS_EXCLUSIVE(true, futex_global_lock) {
-  mutex_lock(&futex_global_lock);
-  *fl = futex_lock_lookup_locked(lock);
+                              struct futex_lock **fl) NO_LOCK_ANALYSIS {
+  struct futex_lock_bucket *flb = futex_lock_bucket(lock);
+  mutex_lock(&flb->flb_lock);
+  *fl = futex_lock_lookup_locked(flb, lock);
   if (*fl == NULL) {
-    mutex_unlock(&futex_global_lock);
+    mutex_unlock(&flb->flb_lock);
     return false;
   }
   return true;
 }
 
-static struct futex_lock *futex_lock_lookup_locked(_Atomic(cloudabi_lock_t) *
-                                                   lock) {
+static struct futex_lock *futex_lock_lookup_locked(
+    struct futex_lock_bucket *flb, _Atomic(cloudabi_lock_t) * lock) {
   struct futex_lock *fl;
-  LIST_FOREACH(fl, &futex_lock_list, fl_next) {
+  LIST_FOREACH(fl, &flb->flb_list, fl_next) {
     if (fl->fl_address == lock) {
       // Found matching lock object.
       futex_lock_assert(fl);
@@ -225,23 +447,26 @@ static struct futex_lock *futex_lock_lookup_locked(_Atomic(cloudabi_lock_t) *
   if (fl == NULL)
     return NULL;
   fl->fl_address = lock;
+  fl->fl_bucket = flb;
   fl->fl_owner = LOCK_UNMANAGED;
   futex_queue_init(&fl->fl_readers);
   futex_queue_init(&fl->fl_writers);
   fl->fl_waitcount = 0;
-  LIST_INSERT_HEAD(&futex_lock_list, fl, fl_next);
+  LIST_INSERT_HEAD(&flb->flb_list, fl, fl_next);
   return fl;
 }
 
 static cloudabi_errno_t futex_lock_rdlock(
     struct futex_lock *fl, cloudabi_tid_t tid, cloudabi_clockid_t clock_id,
-    cloudabi_timestamp_t timeout) REQUIRES_FUTEX_LOCK {
+    cloudabi_timestamp_t timeout, const struct futex_poll_hook *hook)
+    REQUIRES_BUCKET_LOCK(fl) {
   cloudabi_errno_t error = futex_lock_tryrdlock(fl);
   if (error == CLOUDABI_EBUSY) {
     // Suspend execution.
     assert(fl->fl_owner != LOCK_UNMANAGED &&
            "Attempted to sleep on an unmanaged lock");
-    error = futex_queue_sleep(&fl->fl_readers, fl, tid, clock_id, timeout);
+    error =
+        futex_queue_sleep(&fl->fl_readers, fl, tid, clock_id, timeout, hook);
   }
   if (error != 0)
     futex_lock_unmanage(fl);
@@ -264,6 +489,7 @@ static void futex_lock_unmanage(struct futex_lock *fl) {
 
 static void futex_lock_release(struct futex_lock *fl) {
   futex_lock_assert(fl);
+  struct futex_lock_bucket *flb = fl->fl_bucket;
   if (fl->fl_waitcount == 0) {
     // Lock object is unreferenced. Deallocate it.
     assert(fl->fl_owner == LOCK_UNMANAGED &&
@@ -271,7 +497,7 @@ static void futex_lock_release(struct futex_lock *fl) {
     LIST_REMOVE(fl, fl_next);
     free(fl);
   }
-  mutex_unlock(&futex_global_lock);
+  mutex_unlock(&flb->flb_lock);
 }
 
 static void futex_lock_set_owner(struct futex_lock *fl, cloudabi_lock_t lock) {
@@ -291,7 +517,7 @@ static void futex_lock_set_owner(struct futex_lock *fl, cloudabi_lock_t lock) {
 }
 
 static cloudabi_errno_t futex_lock_unlock(
-    struct futex_lock *fl, cloudabi_tid_t tid) REQUIRES_FUTEX_LOCK {
+    struct futex_lock *fl, cloudabi_tid_t tid) REQUIRES_BUCKET_LOCK(fl) {
   // Validate that this thread is allowed to unlock.
   futex_lock_update_owner(fl);
   if (fl->fl_owner != LOCK_UNMANAGED && fl->fl_owner != tid)
@@ -334,7 +560,7 @@ static cloudabi_errno_t futex_lock_tryrdlock(struct futex_lock *fl) {
 
 static cloudabi_errno_t futex_lock_trywrlock(
     struct futex_lock *fl, cloudabi_tid_t tid,
-    bool force_kernel_managed) REQUIRES_FUTEX_LOCK {
+    bool force_kernel_managed) REQUIRES_BUCKET_LOCK(fl) {
   if (fl->fl_owner == tid) {
     // Attempted to acquire lock recursively.
     return CLOUDABI_EDEADLK;
@@ -409,12 +635,14 @@ static void futex_lock_wake_up_next(struct futex_lock *fl) {
 
 static cloudabi_errno_t futex_lock_wrlock(
     struct futex_lock *fl, cloudabi_tid_t tid, cloudabi_clockid_t clock_id,
-    cloudabi_timestamp_t timeout) REQUIRES_FUTEX_LOCK {
+    cloudabi_timestamp_t timeout, const struct futex_poll_hook *hook)
+    REQUIRES_BUCKET_LOCK(fl) {
   cloudabi_errno_t error = futex_lock_trywrlock(fl, tid, false);
   if (error == CLOUDABI_EBUSY) {
     assert(fl->fl_owner != LOCK_UNMANAGED &&
            "Attempted to sleep on an unmanaged lock");
-    error = futex_queue_sleep(&fl->fl_writers, fl, tid, clock_id, timeout);
+    error =
+        futex_queue_sleep(&fl->fl_writers, fl, tid, clock_id, timeout, hook);
   }
   if (error != 0)
     futex_lock_unmanage(fl);
@@ -436,15 +664,20 @@ static void futex_queue_init(struct futex_queue *fq) {
   fq->fq_count = 0;
 }
 
-static cloudabi_errno_t futex_queue_sleep(struct futex_queue *fq,
-                                          struct futex_lock *fl,
-                                          cloudabi_tid_t tid,
-                                          cloudabi_clockid_t clock_id,
-                                          cloudabi_timestamp_t timeout) {
+static cloudabi_errno_t futex_queue_sleep(
+    struct futex_queue *fq, struct futex_lock *fl, cloudabi_tid_t tid,
+    cloudabi_clockid_t clock_id, cloudabi_timestamp_t timeout,
+    const struct futex_poll_hook *hook) {
   // Initialize futex_waiter object.
   struct futex_waiter fw = {
-      .fw_tid = tid, .fw_queue = fq,
+      .fw_tid = tid, .fw_hook = hook, .fw_queue = fq,
   };
+#if CONFIG_HAS_FUTEX
+  if (clock_id != CLOUDABI_CLOCK_MONOTONIC &&
+      clock_id != CLOUDABI_CLOCK_REALTIME)
+    return CLOUDABI_ENOTSUP;
+  atomic_init(&fw.fw_wakeup, 0);
+#else
   switch (clock_id) {
 #if HAS_COND_INIT_MONOTONIC
     case CLOUDABI_CLOCK_MONOTONIC:
@@ -457,24 +690,31 @@ static cloudabi_errno_t futex_queue_sleep(struct futex_queue *fq,
     default:
       return CLOUDABI_ENOTSUP;
   }
+#endif
 
   // Place object in the queue.
   TAILQ_INSERT_TAIL(&fq->fq_list, &fw, fw_next);
   ++fq->fq_count;
 
   ++fl->fl_waitcount;
+  atomic_fetch_add_explicit(&futex_waiters, 1, memory_order_relaxed);
   futex_lock_assert(fl);
   bool timedout;
   do {
-    timedout = cond_timedwait(&fw.fw_wait, &futex_global_lock, timeout);
+    timedout = futex_waiter_sleep(&fw, fl, clock_id, timeout);
   } while (!timedout && fw.fw_queue == fq);
   if (fw.fw_queue != fq) {
+    // Thread got requeued. Timeouts and other events no longer apply.
+    fw.fw_hook = NULL;
     while (fw.fw_queue != NULL)
-      cond_wait(&fw.fw_wait, &futex_global_lock);
+      futex_waiter_sleep(&fw, fl, clock_id, UINT64_MAX);
   }
   futex_lock_assert(fl);
+  atomic_fetch_sub_explicit(&futex_waiters, 1, memory_order_relaxed);
   --fl->fl_waitcount;
+#if !CONFIG_HAS_FUTEX
   cond_destroy(&fw.fw_wait);
+#endif
 
   fq = fw.fw_queue;
   if (fq == NULL) {
@@ -507,10 +747,8 @@ static void futex_queue_requeue(struct futex_queue *fqfrom,
 // Wakes up all waiters in a queue.
 static void futex_queue_wake_up_all(struct futex_queue *fq) {
   struct futex_waiter *fw;
-  TAILQ_FOREACH(fw, &fq->fq_list, fw_next) {
-    fw->fw_queue = NULL;
-    cond_signal(&fw->fw_wait);
-  }
+  TAILQ_FOREACH(fw, &fq->fq_list, fw_next)
+    futex_waiter_wake_up(fw);
 
   TAILQ_INIT(&fq->fq_list);
   fq->fq_count = 0;
@@ -522,18 +760,85 @@ static void futex_queue_wake_up_best(struct futex_queue *fq) {
   struct futex_waiter *fw;
 
   fw = TAILQ_FIRST(&fq->fq_list);
-  fw->fw_queue = NULL;
-  cond_signal(&fw->fw_wait);
-
   TAILQ_REMOVE(&fq->fq_list, fw, fw_next);
   --fq->fq_count;
+  futex_waiter_wake_up(fw);
+}
+
+// futex_waiter operations.
+
+// Blocks the calling thread until it is woken up or until the absolute
+// timeout has passed. The bucket lock is dropped while blocking. Returns
+// true if the timeout has passed or if the hook got interrupted.
+// Spurious wakeups may occur, meaning that callers need to check whether
+// the waiter is still enqueued.
+static bool futex_waiter_sleep(struct futex_waiter *fw, struct futex_lock *fl,
+                               cloudabi_clockid_t clock_id,
+                               cloudabi_timestamp_t timeout) {
+  if (fw->fw_hook != NULL) {
+    // Also waiting on other events. Block through the hook.
+    mutex_unlock(&fl->fl_bucket->flb_lock);
+    bool interrupted = fw->fw_hook->block(fw->fw_hook->arg, clock_id, timeout);
+    mutex_lock(&fl->fl_bucket->flb_lock);
+    return interrupted;
+  }
+
+#if CONFIG_HAS_FUTEX
+  // Park the thread on its own futex word, instead of using a condition
+  // variable. The waker only needs to perform a single FUTEX_WAKE, and
+  // requeueing waiters between queues requires no system calls at all.
+  struct timespec ts = {
+      .tv_sec = timeout / 1000000000, .tv_nsec = timeout % 1000000000,
+  };
+  int op = FUTEX_WAIT_BITSET_PRIVATE;
+  if (clock_id == CLOUDABI_CLOCK_REALTIME)
+    op |= FUTEX_CLOCK_REALTIME;
+
+  bool timedout = false;
+  mutex_unlock(&fl->fl_bucket->flb_lock);
+  while (atomic_load_explicit(&fw->fw_wakeup, memory_order_acquire) == 0) {
+    if (syscall(SYS_futex, &fw->fw_wakeup, op, 0,
+                timeout == UINT64_MAX ? NULL : &ts, NULL,
+                FUTEX_BITSET_MATCH_ANY) != 0 &&
+        errno == ETIMEDOUT) {
+      timedout = true;
+      break;
+    }
+  }
+  mutex_lock(&fl->fl_bucket->flb_lock);
+  return timedout;
+#else
+  if (timeout == UINT64_MAX) {
+    cond_wait(&fw->fw_wait, &fl->fl_bucket->flb_lock);
+    return false;
+  }
+  return cond_timedwait(&fw->fw_wait, &fl->fl_bucket->flb_lock, timeout);
+#endif
+}
+
+// Wakes up a thread blocked in futex_waiter_sleep(). The waiter must
+// already have been removed from its queue. As the bucket lock is held,
+// the waiter cannot return and deallocate its futex word before the
+// wakeup has completed.
+static void futex_waiter_wake_up(struct futex_waiter *fw) {
+  fw->fw_queue = NULL;
+  if (fw->fw_hook != NULL) {
+    fw->fw_hook->wake(fw->fw_hook->arg);
+    return;
+  }
+#if CONFIG_HAS_FUTEX
+  atomic_store_explicit(&fw->fw_wakeup, 1, memory_order_release);
+  syscall(SYS_futex, &fw->fw_wakeup, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#else
+  cond_signal(&fw->fw_wait);
+#endif
 }
 
 static cloudabi_errno_t futex_op_condvar_wait(
     cloudabi_tid_t tid, _Atomic(cloudabi_condvar_t) * condvar,
     cloudabi_scope_t condvar_scope, _Atomic(cloudabi_lock_t) * lock,
     cloudabi_scope_t lock_scope, cloudabi_clockid_t clock_id,
-    cloudabi_timestamp_t timeout) {
+    cloudabi_timestamp_t timeout, const struct futex_poll_hook *hook) {
   if (lock_scope != CLOUDABI_SCOPE_PRIVATE ||
       condvar_scope != CLOUDABI_SCOPE_PRIVATE)
     return CLOUDABI_ENOTSUP;
@@ -545,6 +850,14 @@ static cloudabi_errno_t futex_op_condvar_wait(
     return error;
   struct futex_lock *fl = fc->fc_lock;
 
+  // Reference the condition variable and the lock, so that they remain
+  // allocated while we're blocked. The condition variable's bucket lock
+  // can be dropped afterwards, as we only need to hold the bucket lock
+  // of the lock while sleeping.
+  ++fc->fc_waitcount;
+  ++fl->fl_waitcount;
+  mutex_unlock(&fc->fc_bucket->fcb_lock);
+
   // Set the condition variable to something other than
   // CLOUDABI_CONDVAR_HAS_NO_WAITERS to make userspace threads
   // call into the kernel to perform wakeups.
@@ -559,18 +872,17 @@ static cloudabi_errno_t futex_op_condvar_wait(
   }
 
   // Go to sleep.
-  ++fc->fc_waitcount;
   error =
-      futex_queue_sleep(&fc->fc_waiters, fc->fc_lock, tid, clock_id, timeout);
+      futex_queue_sleep(&fc->fc_waiters, fl, tid, clock_id, timeout, hook);
   if (error != 0) {
-    // We observed a timeout. Reacquire the lock.
+    // We observed a timeout or other events triggered. Reacquire the
+    // lock.
     futex_condvar_unmanage(fc);
     cloudabi_errno_t error2 =
-        futex_lock_wrlock(fl, tid, CLOUDABI_CLOCK_REALTIME, UINT64_MAX);
+        futex_lock_wrlock(fl, tid, CLOUDABI_CLOCK_REALTIME, UINT64_MAX, NULL);
     if (error2 != 0)
       error = error2;
   }
-  --fc->fc_waitcount;
   futex_condvar_release(fc);
   return error;
 }
@@ -591,10 +903,18 @@ cloudabi_errno_t futex_op_condvar_signal(_Atomic(cloudabi_condvar_t) * condvar,
     return CLOUDABI_ENOENT;
   struct futex_lock *fl = fc->fc_lock;
 
+  // All waiters may already have been requeued to the lock, while not
+  // having released the condition variable yet.
+  struct futex_queue *fq = &fc->fc_waiters;
+  if (futex_queue_count(fq) == 0) {
+    futex_condvar_unmanage(fc);
+    futex_condvar_unlock(fc);
+    return 0;
+  }
+
   // Attempt to acquire the lock on behalf of the first waiting thread.
   // Already set the kernel managed flag on the lock if there are
   // additional threads that we are going to wake up.
-  struct futex_queue *fq = &fc->fc_waiters;
   cloudabi_errno_t error = futex_lock_trywrlock(
       fl, futex_queue_tid_best(fq), nwaiters > 1 && futex_queue_count(fq) > 1);
   if (error == 0) {
@@ -608,44 +928,48 @@ cloudabi_errno_t futex_op_condvar_signal(_Atomic(cloudabi_condvar_t) * condvar,
            "Attempted to sleep on an unmanaged lock");
     futex_queue_requeue(fq, &fl->fl_writers, nwaiters);
   } else {
-    futex_condvar_release(fc);
+    futex_condvar_unlock(fc);
     return error;
   }
 
   // Clear userspace condition variable if all waiters are gone.
   futex_condvar_unmanage(fc);
-  futex_condvar_release(fc);
+  futex_condvar_unlock(fc);
   return 0;
 }
 
-static cloudabi_errno_t futex_op_lock_rdlock(cloudabi_tid_t tid,
-                                             _Atomic(cloudabi_lock_t) * lock,
-                                             cloudabi_scope_t scope,
-                                             cloudabi_clockid_t clock_id,
-                                             cloudabi_timestamp_t timeout) {
+static cloudabi_errno_t futex_op_lock_rdlock(
+    cloudabi_tid_t tid, _Atomic(cloudabi_lock_t) * lock, cloudabi_scope_t scope,
+    cloudabi_clockid_t clock_id, cloudabi_timestamp_t timeout,
+    const struct futex_poll_hook *hook) {
   if (scope != CLOUDABI_SCOPE_PRIVATE)
     return CLOUDABI_ENOTSUP;
+  if (futex_spin_lock(lock, tid, false))
+    return 0;
 
   struct futex_lock *fl;
   if (!futex_lock_lookup(lock, &fl))
     return CLOUDABI_ENOMEM;
-  cloudabi_errno_t error = futex_lock_rdlock(fl, tid, clock_id, timeout);
+  cloudabi_errno_t error =
+      futex_lock_rdlock(fl, tid, clock_id, timeout, hook);
   futex_lock_release(fl);
   return error;
 }
 
-static cloudabi_errno_t futex_op_lock_wrlock(cloudabi_tid_t tid,
-                                             _Atomic(cloudabi_lock_t) * lock,
-                                             cloudabi_scope_t scope,
-                                             cloudabi_clockid_t clock_id,
-                                             cloudabi_timestamp_t timeout) {
+static cloudabi_errno_t futex_op_lock_wrlock(
+    cloudabi_tid_t tid, _Atomic(cloudabi_lock_t) * lock, cloudabi_scope_t scope,
+    cloudabi_clockid_t clock_id, cloudabi_timestamp_t timeout,
+    const struct futex_poll_hook *hook) {
   if (scope != CLOUDABI_SCOPE_PRIVATE)
     return CLOUDABI_ENOTSUP;
+  if (futex_spin_lock(lock, tid, true))
+    return 0;
 
   struct futex_lock *fl;
   if (!futex_lock_lookup(lock, &fl))
     return CLOUDABI_ENOMEM;
-  cloudabi_errno_t error = futex_lock_wrlock(fl, tid, clock_id, timeout);
+  cloudabi_errno_t error =
+      futex_lock_wrlock(fl, tid, clock_id, timeout, hook);
   futex_lock_release(fl);
   return error;
 }
@@ -664,6 +988,40 @@ cloudabi_errno_t futex_op_lock_unlock(cloudabi_tid_t tid,
   return error;
 }
 
+// Waits on a single futex subscription. Returns false if the
+// subscription is not of a futex type.
+static bool futex_op_wait(cloudabi_tid_t tid, const cloudabi_subscription_t *in,
+                          cloudabi_clockid_t clock_id,
+                          cloudabi_timestamp_t timeout,
+                          const struct futex_poll_hook *hook,
+                          cloudabi_event_t *out) {
+  switch (in->type) {
+    case CLOUDABI_EVENTTYPE_CONDVAR:
+      out->error = futex_op_condvar_wait(
+          tid, in->condvar.condvar, in->condvar.condvar_scope,
+          in->condvar.lock, in->condvar.lock_scope, clock_id, timeout, hook);
+      out->condvar.condvar = in->condvar.condvar;
+      break;
+    case CLOUDABI_EVENTTYPE_LOCK_RDLOCK:
+      out->error = futex_op_lock_rdlock(tid, in->lock.lock,
+                                        in->lock.lock_scope, clock_id,
+                                        timeout, hook);
+      out->lock.lock = in->lock.lock;
+      break;
+    case CLOUDABI_EVENTTYPE_LOCK_WRLOCK:
+      out->error = futex_op_lock_wrlock(tid, in->lock.lock,
+                                        in->lock.lock_scope, clock_id,
+                                        timeout, hook);
+      out->lock.lock = in->lock.lock;
+      break;
+    default:
+      return false;
+  }
+  out->userdata = in->userdata;
+  out->type = in->type;
+  return true;
+}
+
 bool futex_op_poll(cloudabi_tid_t tid, const cloudabi_subscription_t *in,
                    cloudabi_event_t *out, size_t nsubscriptions,
                    size_t *nevents) {
@@ -679,27 +1037,8 @@ bool futex_op_poll(cloudabi_tid_t tid, const cloudabi_subscription_t *in,
       nsubscriptions == 1 ? CLOUDABI_CLOCK_REALTIME : in[1].clock.clock_id;
   cloudabi_timestamp_t timeout =
       nsubscriptions == 1 ? UINT64_MAX : in[1].clock.timeout;
-
-  switch (in[0].type) {
-    case CLOUDABI_EVENTTYPE_CONDVAR:
-      out->error = futex_op_condvar_wait(
-          tid, in[0].condvar.condvar, in[0].condvar.condvar_scope,
-          in[0].condvar.lock, in[0].condvar.lock_scope, clock_id, timeout);
-      out->condvar.condvar = in[0].condvar.condvar;
-      break;
-    case CLOUDABI_EVENTTYPE_LOCK_RDLOCK:
-      out->error = futex_op_lock_rdlock(
-          tid, in[0].lock.lock, in[0].lock.lock_scope, clock_id, timeout);
-      out->lock.lock = in[0].lock.lock;
-      break;
-    case CLOUDABI_EVENTTYPE_LOCK_WRLOCK:
-      out->error = futex_op_lock_wrlock(
-          tid, in[0].lock.lock, in[0].lock.lock_scope, clock_id, timeout);
-      out->lock.lock = in[0].lock.lock;
-      break;
-    default:
-      return false;
-  }
+  if (!futex_op_wait(tid, &in[0], clock_id, timeout, NULL, out))
+    return false;
 
   // If the wait timed out, return the clock event instead.
   if (out->error == CLOUDABI_ETIMEDOUT) {
@@ -707,20 +1046,37 @@ bool futex_op_poll(cloudabi_tid_t tid, const cloudabi_subscription_t *in,
     out->error = 0;
     out->type = in[1].type;
     out->clock.identifier = in[1].clock.identifier;
-  } else {
-    out->userdata = in[0].userdata;
-    out->type = in[0].type;
   }
   *nevents = 1;
   return true;
 }
 
-// Reinitializes the global futex table after forking. After forking,
-// the entries in the table are no longer valid, as they apply to
-// threads in the parent process. Furthermore, the futex_global_lock may
-// have gone corrupt and needs to be reinitialized.
+// Waits on a futex subscription, while also allowing the thread to be
+// interrupted by other events. Instead of sleeping directly, the thread
+// blocks through the hook, which gets woken up when the futex event
+// triggers. When interrupted, the thread is removed from the wait queue
+// in the same way as when a timeout occurs. Returns true if the futex
+// event triggered.
+bool futex_op_poll_hook(cloudabi_tid_t tid, const cloudabi_subscription_t *in,
+                        cloudabi_clockid_t clock_id,
+                        cloudabi_timestamp_t timeout,
+                        const struct futex_poll_hook *hook,
+                        cloudabi_event_t *out) {
+  return futex_op_wait(tid, in, clock_id, timeout, hook, out) &&
+         out->error != CLOUDABI_ETIMEDOUT;
+}
+
+// Returns the number of threads blocked on locks and condition
+// variables.
+unsigned int futex_waiters_get(void) {
+  return atomic_load_explicit(&futex_waiters, memory_order_relaxed);
+}
+
+// Reinitializes the futex hash tables after forking. After forking,
+// the entries in the tables are no longer valid, as they apply to
+// threads in the parent process. Furthermore, the bucket locks may have
+// gone corrupt and need to be reinitialized.
 void futex_postfork(void) {
-  mutex_init(&futex_global_lock);
-  LIST_INIT(&futex_lock_list);
-  LIST_INIT(&futex_condvar_list);
+  futex_table_init();
+  atomic_store_explicit(&futex_waiters, 0, memory_order_relaxed);
 }
@@ -11,6 +11,18 @@
 
 #include <cloudabi_types.h>
 
+// Hook for futex waits that are part of a poll() call that also waits
+// on other events.
+struct futex_poll_hook {
+  // Blocks until woken up through wake(), until the absolute timeout
+  // has passed, or until other events trigger. Returns true if the
+  // wait should be interrupted.
+  bool (*block)(void *, cloudabi_clockid_t, cloudabi_timestamp_t);
+  // Wakes up the thread blocked in block().
+  void (*wake)(void *);
+  void *arg;
+};
+
 cloudabi_errno_t futex_op_condvar_signal(_Atomic(cloudabi_condvar_t) *,
                                          cloudabi_scope_t, cloudabi_nthreads_t);
 cloudabi_errno_t futex_op_lock_unlock(cloudabi_tid_t,
@@ -18,6 +30,14 @@ cloudabi_errno_t futex_op_lock_unlock(cloudabi_tid_t,
                                       cloudabi_scope_t);
 bool futex_op_poll(cloudabi_tid_t, const cloudabi_subscription_t *,
                    cloudabi_event_t *, size_t, size_t *);
+bool futex_op_poll_hook(cloudabi_tid_t, const cloudabi_subscription_t *,
+                        cloudabi_clockid_t, cloudabi_timestamp_t,
+                        const struct futex_poll_hook *, cloudabi_event_t *);
 void futex_postfork(void);
+void futex_set_spin_limit(unsigned int);
+
+// Returns the number of threads blocked on locks and condition
+// variables.
+unsigned int futex_waiters_get(void);
 
 #endif
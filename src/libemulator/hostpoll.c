@@ -0,0 +1,13 @@
+// Copyright (c) 2016 Nuxi, https://nuxi.nl/
+//
+// This file is distributed under a 2-clause BSD license.
+// See the LICENSE file for details.
+
+#include <poll.h>
+#include <stddef.h>
+
+#include "hostpoll.h"
+
+int host_poll(struct pollfd *fds, size_t nfds, int timeout) {
+  return poll(fds, nfds, timeout);
+}
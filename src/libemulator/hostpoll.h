@@ -0,0 +1,17 @@
+// Copyright (c) 2016 Nuxi, https://nuxi.nl/
+//
+// This file is distributed under a 2-clause BSD license.
+// See the LICENSE file for details.
+
+#ifndef HOSTPOLL_H
+#define HOSTPOLL_H
+
+#include <stddef.h>
+
+struct pollfd;
+
+// Calls into the host's poll(). The system call emulation provides a
+// function named poll() of its own, meaning it cannot call it directly.
+int host_poll(struct pollfd *, size_t, int);
+
+#endif
@@ -0,0 +1,90 @@
+// Copyright (c) 2016 Nuxi, https://nuxi.nl/
+//
+// This file is distributed under a 2-clause BSD license.
+// See the LICENSE file for details.
+
+#include "config.h"
+
+#if CONFIG_HAS_VDSO_CLOCK_GETTIME
+#include <sys/auxv.h>
+
+#include <elf.h>
+#include <link.h>
+#endif
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "hostvdso.h"
+
+#if CONFIG_HAS_VDSO_CLOCK_GETTIME
+
+// Hash function used by DT_HASH.
+static uint32_t hostvdso_hash(const char *name) {
+  uint32_t h = 0;
+  for (const unsigned char *s = (const unsigned char *)name; *s != '\0'; ++s) {
+    h = (h << 4) + *s;
+    h ^= (h >> 24) & 0xf0;
+  }
+  return h & 0x0fffffff;
+}
+
+void *hostvdso_lookup(const char *name) {
+  const char *base = (const char *)getauxval(AT_SYSINFO_EHDR);
+  if (base == NULL)
+    return NULL;
+
+  // Determine the load offset and the location of the dynamic section.
+  const ElfW(Ehdr) *ehdr = (const ElfW(Ehdr) *)base;
+  const ElfW(Phdr) *phdrs = (const ElfW(Phdr) *)(base + ehdr->e_phoff);
+  const char *load_offset = NULL;
+  const ElfW(Dyn) *dyns = NULL;
+  for (size_t i = 0; i < ehdr->e_phnum; ++i) {
+    if (phdrs[i].p_type == PT_LOAD && load_offset == NULL)
+      load_offset = base + phdrs[i].p_offset - phdrs[i].p_vaddr;
+    else if (phdrs[i].p_type == PT_DYNAMIC)
+      dyns = (const ElfW(Dyn) *)(base + phdrs[i].p_offset);
+  }
+  if (load_offset == NULL || dyns == NULL)
+    return NULL;
+
+  const Elf32_Word *hash = NULL;
+  const char *strtab = NULL;
+  const ElfW(Sym) *symtab = NULL;
+  for (const ElfW(Dyn) *dyn = dyns; dyn->d_tag != DT_NULL; ++dyn) {
+    switch (dyn->d_tag) {
+      case DT_HASH:
+        hash = (const Elf32_Word *)(load_offset + dyn->d_un.d_ptr);
+        break;
+      case DT_STRTAB:
+        strtab = load_offset + dyn->d_un.d_ptr;
+        break;
+      case DT_SYMTAB:
+        symtab = (const ElfW(Sym) *)(load_offset + dyn->d_un.d_ptr);
+        break;
+    }
+  }
+  if (hash == NULL || strtab == NULL || symtab == NULL)
+    return NULL;
+
+  // Look up the symbol through the DT_HASH table.
+  Elf32_Word nbucket = hash[0];
+  const Elf32_Word *buckets = &hash[2];
+  const Elf32_Word *chains = &hash[2 + nbucket];
+  for (Elf32_Word i = buckets[hostvdso_hash(name) % nbucket]; i != STN_UNDEF;
+       i = chains[i]) {
+    const ElfW(Sym) *sym = &symtab[i];
+    if (ELF64_ST_TYPE(sym->st_info) == STT_FUNC &&
+        sym->st_shndx != SHN_UNDEF && strcmp(strtab + sym->st_name, name) == 0)
+      return (void *)(load_offset + sym->st_value);
+  }
+  return NULL;
+}
+
+#else
+
+void *hostvdso_lookup(const char *name) {
+  return NULL;
+}
+
+#endif
@@ -0,0 +1,19 @@
+// Copyright (c) 2016 Nuxi, https://nuxi.nl/
+//
+// This file is distributed under a 2-clause BSD license.
+// See the LICENSE file for details.
+
+#ifndef HOSTVDSO_H
+#define HOSTVDSO_H
+
+#if defined(__aarch64__)
+#define HOSTVDSO_CLOCK_GETTIME "__kernel_clock_gettime"
+#elif defined(__x86_64__)
+#define HOSTVDSO_CLOCK_GETTIME "__vdso_clock_gettime"
+#endif
+
+// Looks up a function in the vDSO that the kernel provides to the
+// emulator itself. Returns NULL if it cannot be found.
+void *hostvdso_lookup(const char *);
+
+#endif
@@ -0,0 +1,134 @@
+// Copyright (c) 2016 Nuxi, https://nuxi.nl/
+//
+// This file is distributed under a 2-clause BSD license.
+// See the LICENSE file for details.
+
+#include <sys/mman.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "futex.h"
+#include "metrics.h"
+#include "posix.h"
+#include "tls.h"
+
+static struct metrics *metrics;
+static struct fd_table *metrics_fds;
+
+// File descriptor of /proc/self/statm, used to obtain the resident
+// memory on systems that provide it.
+static int metrics_statm = -1;
+
+static uint64_t metrics_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t metrics_rss(void) {
+  if (metrics_statm < 0)
+    return 0;
+  char buf[128];
+  ssize_t len = pread(metrics_statm, buf, sizeof(buf) - 1, 0);
+  if (len <= 0)
+    return 0;
+  buf[len] = '\0';
+  unsigned long long size, resident;
+  if (sscanf(buf, "%llu %llu", &size, &resident) != 2)
+    return 0;
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+static void metrics_set(_Atomic(uint64_t) *value, uint64_t v) {
+  atomic_store_explicit(value, v, memory_order_relaxed);
+}
+
+static void metrics_update(void) {
+  // Gather all values before starting the update, so that readers
+  // never have to wait for them.
+  struct posix_usage pu;
+  posix_usage_get(metrics_fds, &pu);
+  struct posix_allocstats pas;
+  posix_allocstats_get(&pas);
+  uint64_t futex_waiters = futex_waiters_get();
+  uint64_t syscalls = tls_calls_get();
+  uint64_t rss = metrics_rss();
+
+  uint64_t sequence =
+      atomic_load_explicit(&metrics->sequence, memory_order_relaxed);
+  atomic_store_explicit(&metrics->sequence, sequence + 1,
+                        memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  metrics_set(&metrics->timestamp_ns, metrics_now());
+  metrics_set(&metrics->fds_size, pu.fds_size);
+  metrics_set(&metrics->fds_used, pu.fds_used);
+  metrics_set(&metrics->threads, pu.threads);
+  metrics_set(&metrics->futex_waiters, futex_waiters);
+  metrics_set(&metrics->syscalls, syscalls);
+  metrics_set(&metrics->rss_bytes, rss);
+  metrics_set(&metrics->fd_objects, pas.fd_objects);
+  metrics_set(&metrics->scratch_chunks, pas.scratch_chunks);
+  atomic_store_explicit(&metrics->sequence, sequence + 2,
+                        memory_order_release);
+}
+
+static void *metrics_thread(void *arg) {
+  struct timespec ts = {.tv_sec = METRICS_INTERVAL_MS / 1000,
+                        .tv_nsec = METRICS_INTERVAL_MS % 1000 * 1000000};
+  while (nanosleep(&ts, NULL) == 0 || errno == EINTR)
+    metrics_update();
+  return NULL;
+}
+
+bool metrics_start(const char *path, struct fd_table *ft) {
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return false;
+  if (ftruncate(fd, sizeof(*metrics)) != 0) {
+    close(fd);
+    return false;
+  }
+  void *p = mmap(NULL, sizeof(*metrics), PROT_READ | PROT_WRITE, MAP_SHARED,
+                 fd, 0);
+  close(fd);
+  if (p == MAP_FAILED)
+    return false;
+  metrics = p;
+  metrics_fds = ft;
+  metrics_statm = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+
+  metrics->version = METRICS_VERSION;
+  metrics->pid = getpid();
+  metrics->start_ns = metrics_now();
+  metrics_update();
+  atomic_store_explicit(&metrics->magic, METRICS_MAGIC, memory_order_release);
+
+  // Spawn the thread updating the metrics with all signals blocked, so
+  // that signals aimed at the executable are never delivered to it.
+  // The thread does not survive forking, meaning that child processes
+  // leave the metrics untouched.
+  sigset_t mask, oldmask;
+  sigfillset(&mask);
+  pthread_sigmask(SIG_SETMASK, &mask, &oldmask);
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  pthread_t thread;
+  int ret = pthread_create(&thread, &attr, metrics_thread, NULL);
+  pthread_attr_destroy(&attr);
+  pthread_sigmask(SIG_SETMASK, &oldmask, NULL);
+  if (ret != 0) {
+    errno = ret;
+    return false;
+  }
+  return true;
+}
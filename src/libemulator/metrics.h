@@ -0,0 +1,57 @@
+// Copyright (c) 2016 Nuxi, https://nuxi.nl/
+//
+// This file is distributed under a 2-clause BSD license.
+// See the LICENSE file for details.
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Live metrics of an emulated process.
+//
+// The emulator maps this structure from a file and updates it
+// periodically from a background thread, so that tools like
+// cloudabi-stat can observe the process without interacting with it.
+// Updates are published through a sequence counter, which is odd
+// while an update is in progress. Readers should retry reading the
+// values if the sequence counter is odd or has changed. Times are
+// CLOCK_MONOTONIC timestamps in nanoseconds.
+
+#define METRICS_MAGIC UINT32_C(0x4d494243)
+#define METRICS_VERSION 2
+
+// Interval at which the metrics are updated.
+#define METRICS_INTERVAL_MS 100
+
+struct metrics {
+  _Atomic(uint32_t) magic;  // Set once the header is initialized.
+  uint32_t version;         // Version of this layout.
+  uint64_t pid;             // Process ID of the emulator.
+  uint64_t start_ns;        // Time at which the emulator started.
+
+  _Atomic(uint64_t) sequence;       // Odd while being updated.
+  _Atomic(uint64_t) timestamp_ns;   // Time of the last update.
+  _Atomic(uint64_t) fds_size;       // Size of the file descriptor table.
+  _Atomic(uint64_t) fds_used;       // Number of file descriptors in use.
+  _Atomic(uint64_t) threads;        // Number of threads.
+  _Atomic(uint64_t) futex_waiters;  // Threads blocked on locks.
+  _Atomic(uint64_t) syscalls;       // Total number of system calls.
+  _Atomic(uint64_t) rss_bytes;      // Resident memory.
+
+  // Heap allocations made by system calls. See struct posix_allocstats.
+  _Atomic(uint64_t) fd_objects;      // File descriptor objects.
+  _Atomic(uint64_t) scratch_chunks;  // Chunks of scratch memory.
+};
+
+struct fd_table;
+
+// Creates a file at the provided path holding the metrics of the
+// process, and starts updating them. The number of system calls is
+// taken from the counters maintained by tls_syscalls, which exclude
+// leaf system calls.
+bool metrics_start(const char *, struct fd_table *);
+
+#endif
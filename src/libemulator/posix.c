@@ -6,15 +6,25 @@
 #include "config.h"
 
 #include <sys/types.h>
+#if CONFIG_HAS_EPOLL
+#include <sys/epoll.h>
+#endif
 #if CONFIG_HAS_KQUEUE
 #include <sys/event.h>
 #endif
+#if CONFIG_HAS_EPOLL
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#endif
 #include <sys/mman.h>
 #if CONFIG_HAS_PDFORK
 #include <sys/procdesc.h>
 #endif
 #include <sys/socket.h>
 #include <sys/stat.h>
+#if CONFIG_HAS_GETDENTS64 || CONFIG_HAS_OPENAT2
+#include <sys/syscall.h>
+#endif
 #include <sys/time.h>
 #include <sys/times.h>
 #include <sys/uio.h>
@@ -25,6 +35,10 @@
 
 #include <netinet/in.h>
 
+#if CONFIG_HAS_OPENAT2
+#include <linux/openat2.h>
+#endif
+
 #if CONFIG_HAS_MACH_ABSOLUTE_TIME
 #include <mach/mach_time.h>
 #endif
@@ -33,6 +47,14 @@
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#if CONFIG_HAS_EPOLL
+// Only needed for struct pollfd. This file provides a poll() function of
+// its own, so hide the declaration of the host's version.
+#define poll poll_host
+#include <poll.h>
+#undef poll
+#endif
 #include <pthread.h>
 #include <sched.h>
 #include <signal.h>
@@ -47,12 +69,17 @@
 #include <cloudabi_syscalls_info.h>
 #include <cloudabi_syscalls_struct.h>
 
+#include "epoch.h"
 #include "futex.h"
+#include "hostpoll.h"
 #include "locking.h"
 #include "posix.h"
+#include "profile.h"
+#include "queue.h"
 #include "random.h"
 #include "refcount.h"
 #include "rights.h"
+#include "scratch.h"
 #include "str.h"
 #include "tidpool.h"
 #include "tls.h"
@@ -93,6 +120,8 @@ static_assert(sizeof(struct iovec) == sizeof(cloudabi_ciovec_t),
 static _Thread_local struct fd_table *curfds;
 // Current thread's identifier.
 _Thread_local cloudabi_tid_t curtid;
+// Number of threads in the process.
+static _Atomic(unsigned int) posix_threads = 1;
 
 // Converts a POSIX error code to a CloudABI error code.
 static cloudabi_errno_t convert_errno(int error) {
@@ -199,6 +228,11 @@ static cloudabi_timestamp_t convert_timespec(const struct timespec *ts) {
   return (cloudabi_timestamp_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
 }
 
+// The clock system calls and thread_yield() are invoked without
+// switching to the TLS area of the host (see TLS_SYSCALLS_LEAF), which
+// is why they cannot use errno. The functions they call only fail on
+// invalid arguments.
+
 #ifdef CLOCK_REALTIME
 
 // Converts a CloudABI clock identifier to a POSIX clock identifier.
@@ -228,7 +262,7 @@ static cloudabi_errno_t clock_res_get(cloudabi_clockid_t clock_id,
     return CLOUDABI_EINVAL;
   struct timespec ts;
   if (clock_getres(nclock_id, &ts) < 0)
-    return convert_errno(errno);
+    return CLOUDABI_EINVAL;
   *resolution = convert_timespec(&ts);
   return 0;
 }
@@ -241,7 +275,7 @@ static cloudabi_errno_t clock_time_get(cloudabi_clockid_t clock_id,
     return CLOUDABI_EINVAL;
   struct timespec ts;
   if (clock_gettime(nclock_id, &ts) < 0)
-    return convert_errno(errno);
+    return CLOUDABI_EINVAL;
   *time = convert_timespec(&ts);
   return 0;
 }
@@ -303,7 +337,7 @@ static cloudabi_errno_t clock_time_get(cloudabi_clockid_t clock_id,
     case CLOUDABI_CLOCK_PROCESS_CPUTIME_ID: {
       struct tms tms;
       if (times(&tms) == -1)
-        return convert_errno(errno);
+        return CLOUDABI_EINVAL;
       static_assert(1000000000 / CLOCKS_PER_SEC * CLOCKS_PER_SEC == 1000000000,
                     "CLOCKS_PER_SEC needs to be a divisor of one billion");
       *time =
@@ -313,7 +347,7 @@ static cloudabi_errno_t clock_time_get(cloudabi_clockid_t clock_id,
     case CLOUDABI_CLOCK_REALTIME: {
       struct timeval tv;
       if (gettimeofday(&tv, NULL) < 0)
-        return convert_errno(errno);
+        return CLOUDABI_EINVAL;
       *time = convert_timeval(&tv);
       return 0;
     }
@@ -330,10 +364,75 @@ static cloudabi_errno_t condvar_signal(_Atomic(cloudabi_condvar_t) * condvar,
   return futex_op_condvar_signal(condvar, scope, nwaiters);
 }
 
+#if CONFIG_HAS_EPOLL
+
+// Registration of a file descriptor in a polling set. epoll only allows
+// a file descriptor to be registered once, whereas CloudABI allows
+// separate read and write subscriptions, each having their own flags
+// and userdata. Both are combined into a single epoll registration.
+struct poll_registration {
+  cloudabi_fd_t fd;  // File descriptor number.
+  int number;        // Underlying file descriptor number.
+  bool registered;   // Whether the descriptor is registered in epoll.
+  bool oneshot;      // Whether the registration is oneshot.
+  bool onpending;    // Whether the registration is on the pending list.
+  struct {
+    bool present;                  // Subscription exists.
+    bool disabled;                 // Subscription is disabled.
+    bool pending;                  // Event still needs to be returned.
+    bool hangup;                   // Peer has hung up.
+    cloudabi_subflags_t flags;     // CLOUDABI_SUBSCRIPTION_{CLEAR,ONESHOT}.
+    cloudabi_userdata_t userdata;  // Userdata to return.
+  } filters[2];                    // Read and write subscriptions.
+  LIST_ENTRY(poll_registration) bucket;
+  TAILQ_ENTRY(poll_registration) pending;
+};
+
+// Set of file descriptors that can be polled, backed by an epoll
+// instance. Registrations are stored in a hash table keyed by file
+// descriptor number. Events that could not be returned due to a lack of
+// space are placed on a list of pending registrations.
+struct poll_set {
+  int epfd;           // epoll instance.
+  struct mutex lock;  // Lock to protect members below.
+  LIST_HEAD(poll_bucket, poll_registration) * buckets;
+  size_t nbuckets;
+  size_t count;
+  TAILQ_HEAD(, poll_registration) pending;
+};
+
+static cloudabi_errno_t poll_set_init(struct poll_set *ps) {
+  ps->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (ps->epfd < 0)
+    return convert_errno(errno);
+  mutex_init(&ps->lock);
+  ps->buckets = NULL;
+  ps->nbuckets = 0;
+  ps->count = 0;
+  TAILQ_INIT(&ps->pending);
+  return 0;
+}
+
+static void poll_set_destroy(struct poll_set *ps) {
+  for (size_t i = 0; i < ps->nbuckets; ++i) {
+    while (!LIST_EMPTY(&ps->buckets[i])) {
+      struct poll_registration *pr = LIST_FIRST(&ps->buckets[i]);
+      LIST_REMOVE(pr, bucket);
+      free(pr);
+    }
+  }
+  free(ps->buckets);
+  mutex_destroy(&ps->lock);
+  close(ps->epfd);
+}
+
+#endif
+
 struct fd_object {
   struct refcount refcount;
   cloudabi_filetype_t type;
   int number;
+  struct epoch_entry epoch;  // Used to defer freeing the object.
 
   union {
 #if !CONFIG_HAS_PDFORK
@@ -348,27 +447,68 @@ struct fd_object {
 #endif
     // Data associated with directory file descriptors.
     struct {
-      struct mutex lock;            // Lock to protect members below.
-      DIR *handle;                  // Directory handle.
+      struct mutex lock;  // Lock to protect members below.
+#if CONFIG_HAS_GETDENTS64
+      char *buf;       // Entries returned by getdents64().
+      size_t buf_pos;  // Offset of the next entry in the buffer.
+      size_t buf_len;  // Number of bytes stored in the buffer.
+#else
+      DIR *handle;  // Directory handle.
+#endif
       cloudabi_dircookie_t offset;  // Offset of the directory.
+#if !CONFIG_HAS_CAP_ENTER
+      // Directories opened by path_get(). The cache has a lock of its
+      // own, as the lock above is held while reading directory entries.
+      struct mutex cache_lock;
+      struct path_cache *cache;
+#endif
     } directory;
+#if CONFIG_HAS_EPOLL
+    // Data associated with polling objects.
+    struct poll_set poll;
+#endif
   };
 };
 
+// Entries are accessed by lock-free readers, which is why all of their
+// members are atomic.
 struct fd_entry {
-  struct fd_object *object;
-  cloudabi_rights_t rights_base;
-  cloudabi_rights_t rights_inheriting;
+  _Atomic(struct fd_object *) object;
+  _Atomic(cloudabi_rights_t) rights_base;
+  _Atomic(cloudabi_rights_t) rights_inheriting;
+};
+
+// Allocation storing the entries of a file descriptor table.
+struct fd_entries {
+  struct epoch_entry epoch;  // Used to defer freeing the entries.
+  struct fd_entry entries[];
 };
 
+static void fd_entries_free(struct epoch_entry *ee) {
+  free((char *)ee - offsetof(struct fd_entries, epoch));
+}
+
 void fd_table_init(struct fd_table *ft) {
   rwlock_init(&ft->lock);
-  ft->entries = NULL;
-  ft->size = 0;
+  atomic_init(&ft->entries, NULL);
+  atomic_init(&ft->size, 0);
   ft->used = 0;
+  ft->slots = NULL;
   curfds = ft;
 }
 
+// The file descriptor table is kept at most three quarters full, so
+// that randomly picked descriptor numbers remain hard to predict, while
+// the slot search below only needs to inspect a couple of entries.
+static bool fd_table_full(size_t size, size_t used) {
+  return size <= used || size - used < used / 3;
+}
+
+// Number of 64-bit words needed to store the slot bitmap.
+static size_t fd_table_slot_words(size_t size) {
+  return (size + 63) / 64;
+}
+
 // Looks up a file descriptor table entry by number and required rights.
 static cloudabi_errno_t fd_table_get_entry(struct fd_table *ft,
                                            cloudabi_fd_t fd,
@@ -377,9 +517,10 @@ static cloudabi_errno_t fd_table_get_entry(struct fd_table *ft,
                                            struct fd_entry **ret)
     REQUIRES_SHARED(ft->lock) {
   // Test for file descriptor existence.
-  if (fd >= ft->size)
+  if (fd >= atomic_load_explicit(&ft->size, memory_order_relaxed))
     return CLOUDABI_EBADF;
-  struct fd_entry *fe = &ft->entries[fd];
+  struct fd_entry *fe =
+      &atomic_load_explicit(&ft->entries, memory_order_relaxed)[fd];
   if (fe->object == NULL)
     return CLOUDABI_EBADF;
 
@@ -395,33 +536,98 @@ static cloudabi_errno_t fd_table_get_entry(struct fd_table *ft,
 // minimum number of free file descriptor table entries.
 static bool fd_table_grow(struct fd_table *ft, size_t min, size_t incr)
     REQUIRES_EXCLUSIVE(ft->lock) {
-  if (ft->size <= min || ft->size < (ft->used + incr) * 2) {
+  size_t oldsize = atomic_load_explicit(&ft->size, memory_order_relaxed);
+  if (oldsize <= min || fd_table_full(oldsize, ft->used + incr)) {
     // Keep on doubling the table size until we've met our constraints.
-    size_t size = ft->size == 0 ? 1 : ft->size;
-    while (size <= min || size < (ft->used + incr) * 2)
+    size_t size = oldsize == 0 ? 1 : oldsize;
+    while (size <= min || fd_table_full(size, ft->used + incr))
       size *= 2;
 
-    // Grow the file descriptor table's allocation.
-    struct fd_entry *entries = realloc(ft->entries, sizeof(*entries) * size);
-    if (entries == NULL)
+    // Copy the entries into a new allocation, as lock-free readers may
+    // still be accessing the old one.
+    struct fd_entries *fes =
+        malloc(sizeof(*fes) + sizeof(fes->entries[0]) * size);
+    if (fes == NULL)
+      return false;
+    struct fd_entry *entries = fes->entries;
+    size_t oldwords = fd_table_slot_words(oldsize);
+    size_t words = fd_table_slot_words(size);
+    uint64_t *slots = realloc(ft->slots, sizeof(*slots) * words);
+    if (slots == NULL) {
+      free(fes);
       return false;
+    }
+    ft->slots = slots;
+    struct fd_entry *old =
+        atomic_load_explicit(&ft->entries, memory_order_relaxed);
+    for (size_t i = 0; i < oldsize; ++i) {
+      atomic_init(&entries[i].object, old[i].object);
+      atomic_init(&entries[i].rights_base, old[i].rights_base);
+      atomic_init(&entries[i].rights_inheriting, old[i].rights_inheriting);
+    }
 
-    // Mark all new file descriptors as unused.
-    for (size_t i = ft->size; i < size; ++i)
-      entries[i].object = NULL;
-    ft->entries = entries;
-    ft->size = size;
+    // Mark all new file descriptors as unused. Bits in the slot bitmap
+    // beyond the end of the table are marked as being in use, so that
+    // they are never picked.
+    for (size_t i = oldsize; i < size; ++i) {
+      atomic_init(&entries[i].object, NULL);
+      atomic_init(&entries[i].rights_base, 0);
+      atomic_init(&entries[i].rights_inheriting, 0);
+    }
+    for (size_t i = oldwords; i < words; ++i)
+      slots[i] = 0;
+    if (oldsize % 64 != 0)
+      slots[oldwords - 1] &= ~(UINT64_MAX << oldsize % 64);
+    if (size % 64 != 0)
+      slots[words - 1] |= UINT64_MAX << size % 64;
+
+    // Publish the new entries before the new size, so that readers
+    // never index the old entries beyond their bounds.
+    atomic_store_explicit(&ft->entries, entries, memory_order_release);
+    atomic_store_explicit(&ft->size, size, memory_order_release);
+    if (old != NULL) {
+      struct fd_entries *oldfes =
+          (struct fd_entries *)((char *)old -
+                                offsetof(struct fd_entries, entries));
+      epoch_retire(&oldfes->epoch, fd_entries_free);
+    }
   }
   return true;
 }
 
+// Per-thread cache of unused file descriptor objects, so that creating
+// and closing file descriptors doesn't need to call into malloc().
+#define FD_OBJECT_CACHE_SIZE 64
+static _Thread_local struct fd_object *fd_object_cache[FD_OBJECT_CACHE_SIZE];
+static _Thread_local size_t fd_object_cached = 0;
+static _Atomic(uint64_t) fd_object_allocations = 0;
+
+// Returns an unused file descriptor object to the cache.
+static void fd_object_free(struct fd_object *fo) {
+  if (fd_object_cached < FD_OBJECT_CACHE_SIZE)
+    fd_object_cache[fd_object_cached++] = fo;
+  else
+    free(fo);
+}
+
+static void fd_object_free_epoch(struct epoch_entry *ee) {
+  fd_object_free(
+      (struct fd_object *)((char *)ee - offsetof(struct fd_object, epoch)));
+}
+
 // Allocates a new file descriptor object.
 static cloudabi_errno_t fd_object_new(cloudabi_filetype_t type,
                                       struct fd_object **fo)
     TRYLOCKS_SHARED(0, (*fo)->refcount) {
-  *fo = malloc(sizeof(**fo));
-  if (*fo == NULL)
-    return CLOUDABI_ENOMEM;
+  if (fd_object_cached > 0) {
+    *fo = fd_object_cache[--fd_object_cached];
+  } else {
+    *fo = malloc(sizeof(**fo));
+    if (*fo == NULL)
+      return CLOUDABI_ENOMEM;
+    atomic_fetch_add_explicit(&fd_object_allocations, 1,
+                              memory_order_relaxed);
+  }
   refcount_init(&(*fo)->refcount, 1);
   (*fo)->type = type;
   (*fo)->number = -1;
@@ -434,13 +640,17 @@ static void fd_table_attach(struct fd_table *ft, cloudabi_fd_t fd,
                             cloudabi_rights_t rights_inheriting)
     REQUIRES_EXCLUSIVE(ft->lock) CONSUMES(fo->refcount) {
   assert(ft->size > fd && "File descriptor table too small");
-  struct fd_entry *fe = &ft->entries[fd];
+  struct fd_entry *fe =
+      &atomic_load_explicit(&ft->entries, memory_order_relaxed)[fd];
   assert(fe->object == NULL && "Attempted to overwrite an existing descriptor");
-  fe->object = fo;
-  fe->rights_base = rights_base;
-  fe->rights_inheriting = rights_inheriting;
+  atomic_store_explicit(&fe->rights_base, rights_base, memory_order_relaxed);
+  atomic_store_explicit(&fe->rights_inheriting, rights_inheriting,
+                        memory_order_relaxed);
+  atomic_store_explicit(&fe->object, fo, memory_order_release);
+  ft->slots[fd / 64] |= UINT64_C(1) << fd % 64;
   ++ft->used;
-  assert(ft->size >= ft->used * 2 && "File descriptor too full");
+  assert(!fd_table_full(ft->size, ft->used) &&
+         "File descriptor table too full");
 }
 
 // Detaches a file descriptor from the file descriptor table.
@@ -448,10 +658,12 @@ static void fd_table_detach(struct fd_table *ft, cloudabi_fd_t fd,
                             struct fd_object **fo) REQUIRES_EXCLUSIVE(ft->lock)
     PRODUCES((*fo)->refcount) {
   assert(ft->size > fd && "File descriptor table too small");
-  struct fd_entry *fe = &ft->entries[fd];
-  *fo = fe->object;
+  struct fd_entry *fe =
+      &atomic_load_explicit(&ft->entries, memory_order_relaxed)[fd];
+  *fo = atomic_load_explicit(&fe->object, memory_order_relaxed);
   assert(*fo != NULL && "Attempted to detach nonexistent descriptor");
-  fe->object = NULL;
+  atomic_store_explicit(&fe->object, NULL, memory_order_relaxed);
+  ft->slots[fd / 64] &= ~(UINT64_C(1) << fd % 64);
   assert(ft->used > 0 && "Reference count mismatch");
   --ft->used;
 }
@@ -539,22 +751,267 @@ static int fd_number(const struct fd_object *fo) {
   return number;
 }
 
+#if !CONFIG_HAS_CAP_ENTER
+// Number of directories cached per directory file descriptor.
+#define PATH_CACHE_SIZE 8
+
+// Directory underneath a directory file descriptor that has been opened
+// by path_get(). It is kept open, so that subsequent lookups of files
+// stored in it don't need to open all directories leading up to it. The
+// device and inode number are used to check whether the pathname still
+// refers to the same directory, as it may have been renamed, removed or
+// replaced by a symbolic link in the meantime.
+struct path_cache_entry {
+  char *prefix;        // Normalized pathname of the directory.
+  int fd;              // File descriptor of the directory.
+  dev_t dev;           // Device number of the directory.
+  ino_t ino;           // Inode number of the directory.
+  unsigned int refs;   // Number of leases using the file descriptor.
+  bool cached;         // Whether the entry is still part of the cache.
+  uint64_t last_used;  // Used to evict the least recently used entry.
+};
+
+struct path_cache {
+  struct path_cache_entry *entries[PATH_CACHE_SIZE];
+  uint64_t clock;
+};
+
+static void path_cache_entry_free(struct path_cache_entry *pce) {
+  close(pce->fd);
+  free(pce->prefix);
+  free(pce);
+}
+
+// Removes an entry from the cache. The entry is freed as soon as it is
+// no longer being used.
+static void path_cache_evict(struct path_cache *pc, size_t i) {
+  struct path_cache_entry *pce = pc->entries[i];
+  pc->entries[i] = NULL;
+  pce->cached = false;
+  if (pce->refs == 0)
+    path_cache_entry_free(pce);
+}
+
+static void path_cache_destroy(struct path_cache *pc) {
+  if (pc != NULL) {
+    for (size_t i = 0; i < PATH_CACHE_SIZE; ++i) {
+      if (pc->entries[i] != NULL) {
+        assert(pc->entries[i]->refs == 0 && "Cache entry still in use");
+        path_cache_evict(pc, i);
+      }
+    }
+    free(pc);
+  }
+}
+
+// Tests whether a pathname starts with the normalized pathname of a
+// cached directory. If so, returns the remainder of the pathname that
+// needs to be resolved relative to the cached directory.
+static const char *path_cache_match(const char *prefix, const char *path) {
+  for (;;) {
+    // Skip "." components, which the normalized pathname lacks.
+    while (path[0] == '.' && path[1] == '/')
+      path += 1 + strspn(path + 1, "/");
+
+    size_t len = strcspn(prefix, "/");
+    if (strncmp(path, prefix, len) != 0 || path[len] != '/')
+      return NULL;
+    path += len + strspn(path + len, "/");
+    prefix += len;
+    if (*prefix == '\0')
+      return *path == '\0' ? NULL : path;
+    ++prefix;
+  }
+}
+
+// Checks whether the pathname of a cached directory still refers to the
+// same directory. AT_SYMLINK_NOFOLLOW only applies to the final
+// component of a pathname, which is why all directories leading up to
+// it are checked as well. If none of them are symbolic links, the
+// directory is still stored underneath the directory file descriptor.
+static bool path_cache_validate(struct fd_object *fo,
+                                const struct path_cache_entry *pce) {
+  char *path = scratch_nullterminate(pce->prefix, strlen(pce->prefix));
+  if (path == NULL)
+    return false;
+  struct stat sb;
+  for (char *slash = path; (slash = strchr(slash, '/')) != NULL;) {
+    *slash = '\0';
+    bool isdir = fstatat(fd_number(fo), path, &sb, AT_SYMLINK_NOFOLLOW) == 0 &&
+                 S_ISDIR(sb.st_mode);
+    *slash++ = '/';
+    if (!isdir)
+      return false;
+  }
+  return fstatat(fd_number(fo), path, &sb, AT_SYMLINK_NOFOLLOW) == 0 &&
+         sb.st_dev == pce->dev && sb.st_ino == pce->ino;
+}
+
+// Looks up the deepest cached directory that contains the pathname,
+// acquiring a reference to it. The length of the part of the pathname
+// that it corresponds with is stored in 'skip'.
+static struct path_cache_entry *path_cache_get(struct fd_object *fo,
+                                               const char *path,
+                                               size_t *skip) {
+  struct path_cache_entry *best = NULL;
+  mutex_lock(&fo->directory.cache_lock);
+  struct path_cache *pc = fo->directory.cache;
+  if (pc != NULL) {
+    for (size_t i = 0; i < PATH_CACHE_SIZE; ++i) {
+      struct path_cache_entry *pce = pc->entries[i];
+      if (pce != NULL) {
+        const char *r = path_cache_match(pce->prefix, path);
+        if (r != NULL && (best == NULL || r - path > *skip)) {
+          best = pce;
+          *skip = r - path;
+        }
+      }
+    }
+    if (best != NULL) {
+      ++best->refs;
+      best->last_used = ++pc->clock;
+    }
+  }
+  mutex_unlock(&fo->directory.cache_lock);
+  if (best == NULL)
+    return NULL;
+
+  if (path_cache_validate(fo, best))
+    return best;
+
+  // Pathname has been changed. Discard the entry.
+  mutex_lock(&fo->directory.cache_lock);
+  --best->refs;
+  if (best->cached) {
+    for (size_t i = 0; i < PATH_CACHE_SIZE; ++i) {
+      if (pc->entries[i] == best) {
+        path_cache_evict(pc, i);
+        break;
+      }
+    }
+  } else if (best->refs == 0) {
+    path_cache_entry_free(best);
+  }
+  mutex_unlock(&fo->directory.cache_lock);
+  *skip = 0;
+  return NULL;
+}
+
+// Releases a reference to a cached directory.
+static void path_cache_put(struct fd_object *fo, struct path_cache_entry *pce) {
+  mutex_lock(&fo->directory.cache_lock);
+  assert(pce->refs > 0 && "Cache entry not in use");
+  if (--pce->refs == 0 && !pce->cached)
+    path_cache_entry_free(pce);
+  mutex_unlock(&fo->directory.cache_lock);
+}
+
+// Adds a directory that was opened by path_get() to the cache, taking
+// ownership of its file descriptor. Returns a reference to the new
+// entry, or NULL if the directory could not be cached.
+static struct path_cache_entry *path_cache_insert(struct fd_object *fo,
+                                                  const char *path,
+                                                  size_t pathlen, int fd) {
+  // Normalize the pathname by removing "." components and redundant
+  // slashes, so that lookups can match it.
+  char *prefix = malloc(pathlen + 1);
+  if (prefix == NULL)
+    return NULL;
+  size_t prefixlen = 0;
+  for (size_t i = 0; i < pathlen;) {
+    size_t len = strcspn(path + i, "/");
+    if (len > pathlen - i)
+      len = pathlen - i;
+    if (len > 0 && !(len == 1 && path[i] == '.')) {
+      if (prefixlen > 0)
+        prefix[prefixlen++] = '/';
+      memcpy(prefix + prefixlen, path + i, len);
+      prefixlen += len;
+    }
+    i += len + 1;
+  }
+  prefix[prefixlen] = '\0';
+
+  struct stat sb;
+  struct path_cache_entry *pce;
+  if (prefixlen == 0 || fstat(fd, &sb) != 0 ||
+      (pce = malloc(sizeof(*pce))) == NULL) {
+    free(prefix);
+    return NULL;
+  }
+  pce->prefix = prefix;
+  pce->fd = fd;
+  pce->dev = sb.st_dev;
+  pce->ino = sb.st_ino;
+  pce->refs = 1;
+  pce->cached = true;
+
+  mutex_lock(&fo->directory.cache_lock);
+  struct path_cache *pc = fo->directory.cache;
+  if (pc == NULL) {
+    pc = calloc(1, sizeof(*pc));
+    if (pc == NULL) {
+      mutex_unlock(&fo->directory.cache_lock);
+      free(prefix);
+      free(pce);
+      return NULL;
+    }
+    fo->directory.cache = pc;
+  }
+
+  // Replace an existing entry for the same directory, an empty slot or
+  // the least recently used entry, in that order.
+  size_t slot = 0;
+  for (size_t i = 0; i < PATH_CACHE_SIZE; ++i) {
+    if (pc->entries[i] == NULL) {
+      slot = i;
+    } else if (strcmp(pc->entries[i]->prefix, prefix) == 0) {
+      slot = i;
+      break;
+    } else if (pc->entries[slot] != NULL &&
+               pc->entries[i]->last_used < pc->entries[slot]->last_used) {
+      slot = i;
+    }
+  }
+  if (pc->entries[slot] != NULL)
+    path_cache_evict(pc, slot);
+  pce->last_used = ++pc->clock;
+  pc->entries[slot] = pce;
+  mutex_unlock(&fo->directory.cache_lock);
+  return pce;
+}
+#endif
+
 // Lowers the reference count on a file descriptor object. When the
 // reference count reaches zero, its resources are cleaned up.
 static void fd_object_release(struct fd_object *fo) UNLOCKS(fo->refcount) {
   if (refcount_release(&fo->refcount)) {
     switch (fo->type) {
       case CLOUDABI_FILETYPE_DIRECTORY:
+#if !CONFIG_HAS_CAP_ENTER
+        path_cache_destroy(fo->directory.cache);
+        mutex_destroy(&fo->directory.cache_lock);
+#endif
+        mutex_destroy(&fo->directory.lock);
+#if CONFIG_HAS_GETDENTS64
+        free(fo->directory.buf);
+        close(fd_number(fo));
+#else
         // For directories we may keep track of a DIR object. Calling
         // closedir() on it also closes the underlying file descriptor.
-        mutex_destroy(&fo->directory.lock);
         if (fo->directory.handle == NULL) {
           close(fd_number(fo));
         } else {
           closedir(fo->directory.handle);
         }
+#endif
+        break;
+#if CONFIG_HAS_EPOLL
+      case CLOUDABI_FILETYPE_POLL:
+        // Closes the underlying epoll instance.
+        poll_set_destroy(&fo->poll);
         break;
-#if !CONFIG_HAS_KQUEUE
+#elif !CONFIG_HAS_KQUEUE
       case CLOUDABI_FILETYPE_POLL:
         break;
 #endif
@@ -573,7 +1030,9 @@ static void fd_object_release(struct fd_object *fo) UNLOCKS(fo->refcount) {
         close(fd_number(fo));
         break;
     }
-    free(fo);
+
+    // Lock-free readers may still be inspecting the object.
+    epoch_retire(&fo->epoch, fd_object_free_epoch);
   }
 }
 
@@ -593,7 +1052,15 @@ bool fd_table_insert_existing(struct fd_table *ft, cloudabi_fd_t in, int out) {
   fo->number = out;
   if (type == CLOUDABI_FILETYPE_DIRECTORY) {
     mutex_init(&fo->directory.lock);
+#if CONFIG_HAS_GETDENTS64
+    fo->directory.buf = NULL;
+#else
     fo->directory.handle = NULL;
+#endif
+#if !CONFIG_HAS_CAP_ENTER
+    mutex_init(&fo->directory.cache_lock);
+    fo->directory.cache = NULL;
+#endif
   }
 
   // Grow the file descriptor table if needed.
@@ -609,15 +1076,40 @@ bool fd_table_insert_existing(struct fd_table *ft, cloudabi_fd_t in, int out) {
   return true;
 }
 
-// Picks an unused slot from the file descriptor table.
+void posix_allocstats_get(struct posix_allocstats *pas) {
+  pas->fd_objects =
+      atomic_load_explicit(&fd_object_allocations, memory_order_relaxed);
+  pas->scratch_chunks = scratch_chunks_allocated();
+}
+
+void posix_usage_get(struct fd_table *ft, struct posix_usage *pu) {
+  rwlock_rdlock(&ft->lock);
+  pu->fds_size = ft->size;
+  pu->fds_used = ft->used;
+  rwlock_unlock(&ft->lock);
+  pu->threads = atomic_load_explicit(&posix_threads, memory_order_relaxed);
+}
+
+// Picks an unused slot from the file descriptor table. Instead of
+// probing random slots until a free one is found, scan the bitmap for a
+// word containing free slots, starting at a random word. One of the
+// free slots within that word is then picked at random, so that slots
+// directly following a run of used slots are not favoured.
 static cloudabi_fd_t fd_table_unused(struct fd_table *ft)
     REQUIRES_SHARED(ft->lock) {
-  assert(ft->size > ft->used && "File descriptor table has no free slots");
-  for (;;) {
-    cloudabi_fd_t fd = random_uniform(ft->size);
-    if (ft->entries[fd].object == NULL)
-      return fd;
+  size_t size = ft->size;
+  assert(size > ft->used && "File descriptor table has no free slots");
+  size_t words = fd_table_slot_words(size);
+  size_t word = random_uniform(words);
+  uint64_t unused;
+  while ((unused = ~ft->slots[word]) == 0) {
+    if (++word == words)
+      word = 0;
   }
+  for (uintmax_t skip = random_uniform(__builtin_popcountll(unused));
+       skip > 0; --skip)
+    unused &= unused - 1;
+  return word * 64 + __builtin_ctzll(unused);
 }
 
 // Inserts a file descriptor object into an unused slot of the file
@@ -658,7 +1150,15 @@ static cloudabi_errno_t fd_table_insert_fd(struct fd_table *ft, int in,
   fo->number = in;
   if (type == CLOUDABI_FILETYPE_DIRECTORY) {
     mutex_init(&fo->directory.lock);
+#if CONFIG_HAS_GETDENTS64
+    fo->directory.buf = NULL;
+#else
     fo->directory.handle = NULL;
+#endif
+#if !CONFIG_HAS_CAP_ENTER
+    mutex_init(&fo->directory.cache_lock);
+    fo->directory.cache = NULL;
+#endif
   }
   return fd_table_insert(ft, fo, rights_base, rights_inheriting, out);
 }
@@ -742,6 +1242,19 @@ static cloudabi_errno_t fd_create1(cloudabi_filetype_t type,
         return convert_errno(errno);
       return fd_table_insert_fd(curfds, nfd, CLOUDABI_FILETYPE_POLL,
                                 RIGHTS_POLL_BASE, RIGHTS_POLL_INHERITING, fd);
+#elif CONFIG_HAS_EPOLL
+      struct fd_object *fo;
+      cloudabi_errno_t error = fd_object_new(CLOUDABI_FILETYPE_POLL, &fo);
+      if (error != 0)
+        return error;
+      error = poll_set_init(&fo->poll);
+      if (error != 0) {
+        fd_object_free(fo);
+        return error;
+      }
+      fo->number = fo->poll.epfd;
+      return fd_table_insert(curfds, fo, RIGHTS_POLL_BASE,
+                             RIGHTS_POLL_INHERITING, fd);
 #else
       struct fd_object *fo;
       cloudabi_errno_t error = fd_object_new(CLOUDABI_FILETYPE_POLL, &fo);
@@ -821,30 +1334,75 @@ static cloudabi_errno_t fd_create2(cloudabi_filetype_t type, cloudabi_fd_t *fd1,
   }
 }
 
-// Temporarily locks the file descriptor table to look up a file
-// descriptor object, increases its reference count and drops the lock.
+// Looks up a file descriptor object without locking the file descriptor
+// table and increases its reference count. A copy of the rights is also
+// returned, so callers can still access those if needed.
+static cloudabi_errno_t fd_object_get_rights(
+    struct fd_object **fo, cloudabi_fd_t fd, cloudabi_rights_t rights_base,
+    cloudabi_rights_t rights_inheriting, cloudabi_rights_t *base,
+    cloudabi_rights_t *inheriting) TRYLOCKS_EXCLUSIVE(0, (*fo)->refcount)
+    NO_LOCK_ANALYSIS {
+  struct fd_table *ft = curfds;
+  for (;;) {
+    // Objects and tables referenced by the table are only freed after
+    // we have left the epoch section.
+    if (!epoch_enter())
+      return CLOUDABI_ENOMEM;
+
+    // Test whether the file descriptor number is valid. The size is
+    // loaded before the entries, as the table only ever grows.
+    if (fd >= atomic_load_explicit(&ft->size, memory_order_acquire)) {
+      epoch_exit();
+      return CLOUDABI_EBADF;
+    }
+    struct fd_entry *entries =
+        atomic_load_explicit(&ft->entries, memory_order_acquire);
+    struct fd_entry *fe = &entries[fd];
+    struct fd_object *object =
+        atomic_load_explicit(&fe->object, memory_order_acquire);
+    if (object == NULL) {
+      epoch_exit();
+      return CLOUDABI_EBADF;
+    }
+
+    // Validate rights.
+    *base = atomic_load_explicit(&fe->rights_base, memory_order_relaxed);
+    *inheriting =
+        atomic_load_explicit(&fe->rights_inheriting, memory_order_relaxed);
+    if ((~*base & rights_base) != 0 ||
+        (~*inheriting & rights_inheriting) != 0) {
+      epoch_exit();
+      return CLOUDABI_ENOTCAPABLE;
+    }
+
+    // Increase the reference count on the file descriptor object. It
+    // may have dropped to zero if the descriptor is being closed.
+    if (!refcount_acquire_if_not_zero(&object->refcount)) {
+      epoch_exit();
+      return CLOUDABI_EBADF;
+    }
+
+    // Retry if the entry got replaced while acquiring the reference.
+    bool unchanged =
+        atomic_load_explicit(&ft->entries, memory_order_acquire) ==
+            entries &&
+        atomic_load_explicit(&fe->object, memory_order_acquire) == object;
+    epoch_exit();
+    if (unchanged) {
+      *fo = object;
+      return 0;
+    }
+    fd_object_release(object);
+  }
+}
+
 static cloudabi_errno_t fd_object_get(struct fd_object **fo, cloudabi_fd_t fd,
                                       cloudabi_rights_t rights_base,
                                       cloudabi_rights_t rights_inheriting)
     TRYLOCKS_EXCLUSIVE(0, (*fo)->refcount) {
-  // Test whether the file descriptor number is valid.
-  struct fd_table *ft = curfds;
-  rwlock_rdlock(&ft->lock);
-  struct fd_entry *fe;
-  cloudabi_errno_t error =
-      fd_table_get_entry(ft, fd, rights_base, rights_inheriting, &fe);
-  if (error != 0) {
-    rwlock_unlock(&ft->lock);
-    return error;
-  }
-
-  // Increase the reference count on the file descriptor object. A copy
-  // of the rights are also stored, so callers can still access those if
-  // needed.
-  *fo = fe->object;
-  refcount_acquire(&(*fo)->refcount);
-  rwlock_unlock(&ft->lock);
-  return 0;
+  cloudabi_rights_t base, inheriting;
+  return fd_object_get_rights(fo, fd, rights_base, rights_inheriting, &base,
+                              &inheriting);
 }
 
 static cloudabi_errno_t fd_datasync(cloudabi_fd_t fd) {
@@ -868,6 +1426,13 @@ static cloudabi_errno_t fd_datasync(cloudabi_fd_t fd) {
 static cloudabi_errno_t fd_dup(cloudabi_fd_t from, cloudabi_fd_t *fd) {
   struct fd_table *ft = curfds;
   rwlock_wrlock(&ft->lock);
+
+  // Grow the file descriptor table if needed. This is done prior to
+  // looking up the entry, as growing moves the entries.
+  if (!fd_table_grow(ft, 0, 1)) {
+    rwlock_unlock(&ft->lock);
+    return convert_errno(errno);
+  }
   struct fd_entry *fe;
   cloudabi_errno_t error = fd_table_get_entry(ft, from, 0, 0, &fe);
   if (error != 0) {
@@ -875,12 +1440,6 @@ static cloudabi_errno_t fd_dup(cloudabi_fd_t from, cloudabi_fd_t *fd) {
     return error;
   }
 
-  // Grow the file descriptor table if needed.
-  if (!fd_table_grow(ft, 0, 1)) {
-    rwlock_unlock(&ft->lock);
-    return convert_errno(errno);
-  }
-
   // Attach it to a new place in the table.
   *fd = fd_table_unused(ft);
   refcount_acquire(&fe->object->refcount);
@@ -1078,27 +1637,24 @@ static cloudabi_errno_t fd_seek(cloudabi_fd_t fd, cloudabi_filedelta_t offset,
 }
 
 static cloudabi_errno_t fd_stat_get(cloudabi_fd_t fd, cloudabi_fdstat_t *buf) {
-  struct fd_table *ft = curfds;
-  rwlock_rdlock(&ft->lock);
-  struct fd_entry *fe;
-  cloudabi_errno_t error = fd_table_get_entry(ft, fd, 0, 0, &fe);
-  if (error != 0) {
-    rwlock_unlock(&ft->lock);
+  struct fd_object *fo;
+  cloudabi_rights_t base, inheriting;
+  cloudabi_errno_t error =
+      fd_object_get_rights(&fo, fd, 0, 0, &base, &inheriting);
+  if (error != 0)
     return error;
-  }
 
   // Extract file descriptor type and rights.
-  struct fd_object *fo = fe->object;
   *buf = (cloudabi_fdstat_t){
       .fs_filetype = fo->type,
-      .fs_rights_base = fe->rights_base,
-      .fs_rights_inheriting = fe->rights_inheriting,
+      .fs_rights_base = base,
+      .fs_rights_inheriting = inheriting,
   };
 
   // Fetch file descriptor flags.
   int ret;
   switch (fo->type) {
-#if !CONFIG_HAS_KQUEUE
+#if !CONFIG_HAS_KQUEUE && !CONFIG_HAS_EPOLL
     case CLOUDABI_FILETYPE_POLL:
       ret = 0;
       break;
@@ -1112,7 +1668,7 @@ static cloudabi_errno_t fd_stat_get(cloudabi_fd_t fd, cloudabi_fdstat_t *buf) {
       ret = fcntl(fd_number(fo), F_GETFL);
       break;
   }
-  rwlock_unlock(&ft->lock);
+  fd_object_release(fo);
   if (ret < 0)
     return convert_errno(errno);
 
@@ -1277,13 +1833,13 @@ static cloudabi_errno_t file_advise(cloudabi_fd_t fd,
   }
 
   // At least check for file descriptor existence.
-  struct fd_table *ft = curfds;
-  rwlock_rdlock(&ft->lock);
-  struct fd_entry *fe;
+  struct fd_object *fo;
   cloudabi_errno_t error =
-      fd_table_get_entry(ft, fd, CLOUDABI_RIGHT_FILE_ADVISE, 0, &fe);
-  rwlock_unlock(&ft->lock);
-  return error;
+      fd_object_get(&fo, fd, CLOUDABI_RIGHT_FILE_ADVISE, 0);
+  if (error != 0)
+    return error;
+  fd_object_release(fo);
+  return 0;
 #endif
 }
 
@@ -1315,29 +1871,25 @@ static cloudabi_errno_t file_allocate(cloudabi_fd_t fd,
 }
 
 // Reads the entire contents of a symbolic link, returning the contents
-// in an allocated buffer. The allocated buffer is large enough to fit
-// at least one extra byte, so the caller may append a trailing slash to
-// it. This is needed by path_get().
-static char *readlinkat_dup(int fd, const char *path) {
-  char *buf = NULL;
-  size_t len = 32;
-  for (;;) {
-    char *newbuf = realloc(buf, len);
-    if (newbuf == NULL) {
-      free(buf);
+// in a buffer allocated from the scratch arena. The buffer is large
+// enough to fit at least one extra byte, so the caller may append a
+// trailing slash to it. This is needed by path_get().
+static char *readlinkat_scratch(int fd, const char *path) {
+  struct scratch_mark sm = scratch_mark();
+  for (size_t len = 256;; len *= 2) {
+    char *buf = scratch_alloc(len);
+    if (buf == NULL)
       return NULL;
-    }
-    buf = newbuf;
     ssize_t ret = readlinkat(fd, path, buf, len);
     if (ret < 0) {
-      free(buf);
+      scratch_release(&sm);
       return NULL;
     }
     if (ret + 1 < len) {
       buf[ret] = '\0';
       return buf;
     }
-    len *= 2;
+    scratch_release(&sm);
   }
 }
 
@@ -1351,10 +1903,121 @@ struct path_access {
   int fd;                       // Directory file descriptor.
   const char *path;             // Pathname.
   bool follow;                  // Whether symbolic links should be followed.
-  char *path_start;             // Internal: pathname to free.
+  struct scratch_mark scratch;  // Internal: scratch arena to rewind.
   struct fd_object *fd_object;  // Internal: directory file descriptor object.
+#if !CONFIG_HAS_CAP_ENTER
+  struct path_cache_entry *cache;  // Internal: cached directory in use.
+#endif
 };
 
+#if CONFIG_HAS_OPENAT2
+// Whether openat2() can be used. It is unavailable on older kernels,
+// and sandboxes based on seccomp tend to reject it with EPERM or ENOSYS.
+// It is probed on first use and cleared if it fails in either of these
+// ways later on.
+static atomic_bool path_has_openat2;
+static pthread_once_t path_probe_openat2_once = PTHREAD_ONCE_INIT;
+
+// Passing a structure that is too small lets supporting kernels fail
+// with EINVAL without doing any work.
+static void path_probe_openat2(void) {
+  atomic_store_explicit(
+      &path_has_openat2,
+      syscall(SYS_openat2, AT_FDCWD, ".", NULL, 0) < 0 && errno == EINVAL,
+      memory_order_relaxed);
+}
+
+// Attempts to let the kernel resolve all but the final component of a
+// pathname, using openat2() with RESOLVE_BENEATH to prevent escaping
+// the directory. Returns false if the pathname needs to be resolved by
+// path_get() instead, which is the case for unusual final components
+// and for final components that are symbolic links that need to be
+// followed.
+static bool path_get_beneath(struct path_access *pa, struct fd_object *fo,
+                             char *path, bool follow,
+                             bool needs_final_component,
+                             cloudabi_errno_t *error) {
+  pthread_once(&path_probe_openat2_once, path_probe_openat2);
+  if (!atomic_load_explicit(&path_has_openat2, memory_order_relaxed))
+    return false;
+
+  // Split up the pathname into a directory part and a final component,
+  // ignoring any trailing slashes.
+  char *end = path + strlen(path);
+  char *file_end = end;
+  while (file_end > path && file_end[-1] == '/')
+    --file_end;
+  char *file = file_end;
+  while (file > path && file[-1] != '/')
+    --file;
+  bool ends_with_slashes = file_end != end;
+  if (file == file_end || (ends_with_slashes && !needs_final_component) ||
+      (file_end - file == 1 && file[0] == '.') ||
+      (file_end - file == 2 && file[0] == '.' && file[1] == '.'))
+    return false;
+
+  // Open the directory containing the final component.
+  int dirfd = fd_number(fo);
+  if (file != path) {
+    if (file - 1 == path)
+      return false;
+    file[-1] = '\0';
+    struct open_how how = {
+#ifdef O_SEARCH
+        .flags = O_SEARCH | O_DIRECTORY | O_CLOEXEC,
+#else
+        .flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC,
+#endif
+        .resolve = RESOLVE_BENEATH,
+    };
+    dirfd = syscall(SYS_openat2, dirfd, path, &how, sizeof(how));
+    file[-1] = '/';
+    if (dirfd < 0) {
+      switch (errno) {
+        case ENOSYS:
+        case EPERM:
+          // openat2() is not supported or blocked by a sandbox.
+          atomic_store_explicit(&path_has_openat2, false,
+                                memory_order_relaxed);
+          return false;
+        case EAGAIN:
+          // Concurrent rename while resolving "..".
+          return false;
+        case EXDEV:
+          // Attempted to escape the directory.
+          *error = CLOUDABI_ENOTCAPABLE;
+          return true;
+        default:
+          *error = convert_errno(errno);
+          return true;
+      }
+    }
+  }
+
+  // Let path_get() expand the final component if it is a symbolic link
+  // that needs to be followed.
+  if (follow || ends_with_slashes) {
+    char c;
+    *file_end = '\0';
+    ssize_t ret = readlinkat(dirfd, file, &c, 1);
+    int readlink_errno = errno;
+    *file_end = ends_with_slashes ? '/' : '\0';
+    if (ret >= 0 ||
+        (readlink_errno != EINVAL && readlink_errno != ENOENT)) {
+      if (dirfd != fd_number(fo))
+        close(dirfd);
+      return false;
+    }
+  }
+
+  pa->fd = dirfd;
+  pa->path = file;
+  pa->follow = false;
+  *error = 0;
+  return true;
+}
+#endif
+
 // Creates a lease to a file descriptor and pathname pair. If the
 // operating system does not implement Capsicum, it also normalizes the
 // pathname to ensure the target path is placed underneath the
@@ -1365,7 +2028,10 @@ static cloudabi_errno_t path_get(struct path_access *pa, cloudabi_lookup_t fd,
                                  cloudabi_rights_t rights_inheriting,
                                  bool needs_final_component)
     TRYLOCKS_EXCLUSIVE(0, pa->fd_object->refcount) {
-  char *path = str_nullterminate(upath, upathlen);
+  // All strings are allocated from the scratch arena, so that they can
+  // be freed at once when releasing the lease.
+  struct scratch_mark sm = scratch_mark();
+  char *path = scratch_nullterminate(upath, upathlen);
   if (path == NULL)
     return convert_errno(errno);
 
@@ -1374,7 +2040,7 @@ static cloudabi_errno_t path_get(struct path_access *pa, cloudabi_lookup_t fd,
   cloudabi_errno_t error =
       fd_object_get(&fo, fd.fd, rights_base, rights_inheriting);
   if (error != 0) {
-    free(path);
+    scratch_release(&sm);
     return error;
   }
 
@@ -1382,32 +2048,66 @@ static cloudabi_errno_t path_get(struct path_access *pa, cloudabi_lookup_t fd,
   // Rely on the kernel to constrain access to automatically constrain
   // access to files stored underneath this directory.
   pa->fd = fd_number(fo);
-  pa->path = pa->path_start = path;
+  pa->path = path;
+  pa->scratch = sm;
   pa->follow = (fd.flags & CLOUDABI_LOOKUP_SYMLINK_FOLLOW) != 0;
   pa->fd_object = fo;
   return 0;
 #else
+#if CONFIG_HAS_OPENAT2
+  if (path_get_beneath(pa, fo, path,
+                       (fd.flags & CLOUDABI_LOOKUP_SYMLINK_FOLLOW) != 0,
+                       needs_final_component, &error)) {
+    if (error != 0) {
+      scratch_release(&sm);
+      fd_object_release(fo);
+      return error;
+    }
+    pa->scratch = sm;
+    pa->fd_object = fo;
+    pa->cache = NULL;
+    return 0;
+  }
+#endif
+
   // The implementation provides no mechanism to constrain lookups to a
   // directory automatically. Emulate this logic by resolving the
   // pathname manually.
 
+  // Start resolving at the deepest directory leading up to the file
+  // that is still open from a previous call, if any. The directories
+  // leading up to the file are only cached if they could be resolved
+  // without expanding symlinks or handling "..", as they can then be
+  // validated by a single lookup.
+  struct path_cache_entry *cache = NULL;
+  bool cacheable;
+  size_t skip = 0;
+  if (fo->type == CLOUDABI_FILETYPE_DIRECTORY)
+    cache = path_cache_get(fo, path, &skip);
+
   // Stack of directory file descriptors. Index 0 always corresponds
-  // with the directory provided to this function. Entering a directory
-  // causes a file descriptor to be pushed, while handling ".." entries
-  // causes an entry to be popped. Index 0 cannot be popped, as this
-  // would imply escaping the base directory.
+  // with the directory provided to this function or the cached
+  // directory. Entering a directory causes a file descriptor to be
+  // pushed, while handling ".." entries causes an entry to be popped.
+  // Index 0 cannot be popped, as this would imply escaping the base
+  // directory.
   int fds[128];
-  fds[0] = fd_number(fo);
-  size_t curfd = 0;
+  size_t curfd;
 
   // Stack of pathname strings used for symlink expansion. By using a
   // stack, there is no need to concatenate any pathname strings while
   // expanding symlinks.
   char *paths[32];
-  char *paths_start[32];
-  paths[0] = paths_start[0] = path;
-  size_t curpath = 0;
-  size_t expansions = 0;
+  size_t curpath;
+  size_t expansions;
+
+restart:
+  fds[0] = cache != NULL ? cache->fd : fd_number(fo);
+  curfd = 0;
+  paths[0] = path + skip;
+  curpath = 0;
+  expansions = 0;
+  cacheable = true;
 
   char *symlink;
   for (;;) {
@@ -1432,11 +2132,26 @@ static cloudabi_errno_t path_get(struct path_access *pa, cloudabi_lookup_t fd,
     } else if (strcmp(file, "..") == 0) {
       // Pop a directory off the stack.
       if (curfd == 0) {
+        if (cache != NULL) {
+          // Left the cached directory. Start over from the directory
+          // file descriptor, using a fresh copy of the pathname.
+          path_cache_put(fo, cache);
+          cache = NULL;
+          path = scratch_nullterminate(upath, upathlen);
+          if (path == NULL) {
+            error = convert_errno(errno);
+            goto fail;
+          }
+          skip = 0;
+          goto restart;
+        }
+
         // Attempted to go to parent directory of the directory file
         // descriptor.
         error = CLOUDABI_ENOTCAPABLE;
         goto fail;
       }
+      cacheable = false;
       close(fds[curfd--]);
     } else if (curpath > 0 || *paths[curpath] != '\0' ||
                (ends_with_slashes && !needs_final_component)) {
@@ -1447,9 +2162,11 @@ static cloudabi_errno_t path_get(struct path_access *pa, cloudabi_lookup_t fd,
       // for it.
       int newdir =
 #ifdef O_SEARCH
-          openat(fds[curfd], file, O_SEARCH | O_DIRECTORY | O_NOFOLLOW);
+          openat(fds[curfd], file,
+                 O_SEARCH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
 #else
-          openat(fds[curfd], file, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+          openat(fds[curfd], file,
+                 O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
 #endif
       if (newdir != -1) {
         // Success. Push it onto the directory stack.
@@ -1465,7 +2182,7 @@ static cloudabi_errno_t path_get(struct path_access *pa, cloudabi_lookup_t fd,
           error = convert_errno(errno);
           goto fail;
         }
-        symlink = readlinkat_dup(fds[curfd], file);
+        symlink = readlinkat_scratch(fds[curfd], file);
         if (symlink != NULL)
           goto push_symlink;
         error = convert_errno(errno);
@@ -1477,7 +2194,7 @@ static cloudabi_errno_t path_get(struct path_access *pa, cloudabi_lookup_t fd,
       // expansion.
       if (ends_with_slashes ||
           (fd.flags & CLOUDABI_LOOKUP_SYMLINK_FOLLOW) != 0) {
-        symlink = readlinkat_dup(fds[curfd], file);
+        symlink = readlinkat_scratch(fds[curfd], file);
         if (symlink != NULL)
           goto push_symlink;
         if (errno != EINVAL && errno != ENOENT) {
@@ -1498,7 +2215,22 @@ static cloudabi_errno_t path_get(struct path_access *pa, cloudabi_lookup_t fd,
       if (ends_with_slashes)
         *file_end = '/';
       pa->path = file;
-      pa->path_start = paths_start[0];
+
+      // Keep the directory containing the file open, so that the next
+      // lookup of a file in the same directory can start from there.
+      if (cacheable && curfd > 0 && fo->type == CLOUDABI_FILETYPE_DIRECTORY) {
+        struct path_cache_entry *pce =
+            path_cache_insert(fo, path, file - path, fds[curfd]);
+        if (pce != NULL) {
+          if (cache != NULL)
+            path_cache_put(fo, cache);
+          cache = pce;
+          fds[0] = pce->fd;
+          for (size_t i = 1; i < curfd; ++i)
+            close(fds[i]);
+          curfd = 0;
+        }
+      }
       goto success;
     }
 
@@ -1508,15 +2240,13 @@ static cloudabi_errno_t path_get(struct path_access *pa, cloudabi_lookup_t fd,
         // when called on paths like ".", "a/..", but also if the path
         // had trailing slashes and the caller is not interested in the
         // name of the pathname component.
-        free(paths_start[0]);
         pa->path = ".";
-        pa->path_start = NULL;
         goto success;
       }
 
       // Finished expanding symlink. Continue processing along the
       // original path.
-      free(paths[curpath--]);
+      --curpath;
     }
     continue;
 
@@ -1524,23 +2254,20 @@ static cloudabi_errno_t path_get(struct path_access *pa, cloudabi_lookup_t fd,
     // Prevent infinite loops by placing an upper limit on the number of
     // symlink expansions.
     if (++expansions == 128) {
-      free(symlink);
       error = CLOUDABI_ELOOP;
       goto fail;
     }
-
-    if (*paths[curpath] == '\0') {
-      // The original path already finished processing. Replace it by
-      // this symlink entirely.
-      free(paths_start[curpath]);
-    } else if (curpath + 1 == sizeof(paths) / sizeof(paths[0])) {
-      // Too many nested symlinks. Stop processing.
-      free(symlink);
-      error = CLOUDABI_ELOOP;
-      goto fail;
-    } else {
-      // The original path still has components left. Retain the
-      // components that remain, so we can process them afterwards.
+    cacheable = false;
+
+    // If the original path already finished processing, replace it by
+    // this symlink entirely. Otherwise, retain the components that
+    // remain, so we can process them afterwards.
+    if (*paths[curpath] != '\0') {
+      if (curpath + 1 == sizeof(paths) / sizeof(paths[0])) {
+        // Too many nested symlinks. Stop processing.
+        error = CLOUDABI_ELOOP;
+        goto fail;
+      }
       ++curpath;
     }
 
@@ -1549,7 +2276,7 @@ static cloudabi_errno_t path_get(struct path_access *pa, cloudabi_lookup_t fd,
     // the target is not a directory.
     if (ends_with_slashes)
       strcat(symlink, "/");
-    paths[curpath] = paths_start[curpath] = symlink;
+    paths[curpath] = symlink;
   }
 
 success:
@@ -1559,15 +2286,22 @@ success:
     close(fds[i]);
   pa->fd = fds[curfd];
   pa->follow = false;
+  pa->scratch = sm;
   pa->fd_object = fo;
+  if (cache != NULL && curfd > 0) {
+    path_cache_put(fo, cache);
+    cache = NULL;
+  }
+  pa->cache = cache;
   return 0;
 
 fail:
   // Failure. Free all resources.
   for (size_t i = 1; i <= curfd; ++i)
     close(fds[i]);
-  for (size_t i = 0; i <= curpath; ++i)
-    free(paths_start[i]);
+  if (cache != NULL)
+    path_cache_put(fo, cache);
+  scratch_release(&sm);
   fd_object_release(fo);
   return error;
 #endif
@@ -1583,7 +2317,12 @@ static cloudabi_errno_t path_get_nofollow(
 }
 
 static void path_put(struct path_access *pa) UNLOCKS(pa->fd_object->refcount) {
-  free(pa->path_start);
+  scratch_release(&pa->scratch);
+#if !CONFIG_HAS_CAP_ENTER
+  if (pa->cache != NULL)
+    path_cache_put(pa->fd_object, pa->cache);
+  else
+#endif
   if (fd_number(pa->fd_object) != pa->fd)
     close(pa->fd);
   fd_object_release(pa->fd_object);
@@ -1691,11 +2430,9 @@ static cloudabi_errno_t file_link(cloudabi_lookup_t fd1, const char *path1,
   if (ret < 0 && errno == ENOTSUP && !pa1.follow) {
     // OS X doesn't allow creating hardlinks to symbolic links.
     // Duplicate the symbolic link instead.
-    char *target = readlinkat_dup(pa1.fd, pa1.path);
-    if (target != NULL) {
+    char *target = readlinkat_scratch(pa1.fd, pa1.path);
+    if (target != NULL)
       ret = symlinkat(target, pa2.fd, pa2.path);
-      free(target);
-    }
   }
   path_put(&pa1);
   path_put(&pa2);
@@ -1798,13 +2535,29 @@ static cloudabi_errno_t file_open(cloudabi_lookup_t dirfd, const char *path,
   path_put(&pa);
 
   // Determine the type of the new file descriptor and which rights
-  // contradict with this type.
+  // contradict with this type. Some combinations of open flags already
+  // imply the type, in which case calling fstat() can be avoided.
   cloudabi_filetype_t type;
   cloudabi_rights_t max_base, max_inheriting;
-  error = fd_determine_type_rights(nfd, &type, &max_base, &max_inheriting);
-  if (error != 0) {
-    close(nfd);
-    return error;
+  if ((oflags & (CLOUDABI_O_CREAT | CLOUDABI_O_EXCL)) ==
+      (CLOUDABI_O_CREAT | CLOUDABI_O_EXCL)) {
+    // Exclusive creation always yields a new regular file.
+    type = CLOUDABI_FILETYPE_REGULAR_FILE;
+    max_base = RIGHTS_REGULAR_FILE_BASE;
+    max_inheriting = RIGHTS_REGULAR_FILE_INHERITING;
+  } else if ((oflags & (CLOUDABI_O_CREAT | CLOUDABI_O_DIRECTORY)) ==
+             CLOUDABI_O_DIRECTORY) {
+    // Some versions of Linux create a regular file when O_DIRECTORY is
+    // combined with O_CREAT, so only trust O_DIRECTORY on its own.
+    type = CLOUDABI_FILETYPE_DIRECTORY;
+    max_base = RIGHTS_DIRECTORY_BASE;
+    max_inheriting = RIGHTS_DIRECTORY_INHERITING;
+  } else {
+    error = fd_determine_type_rights(nfd, &type, &max_base, &max_inheriting);
+    if (error != 0) {
+      close(nfd);
+      return error;
+    }
   }
   return fd_table_insert_fd(curfds, nfd, type, rights_base & max_base,
                             rights_inheriting & max_inheriting, fd);
@@ -1821,6 +2574,45 @@ static void file_readdir_put(void *buf, size_t bufsize, size_t *bufused,
   *bufused += elemsize;
 }
 
+// Converts a directory entry type to a CloudABI file type.
+static cloudabi_filetype_t file_readdir_type(unsigned char type) {
+  switch (type) {
+    case DT_BLK:
+      return CLOUDABI_FILETYPE_BLOCK_DEVICE;
+    case DT_CHR:
+      return CLOUDABI_FILETYPE_CHARACTER_DEVICE;
+    case DT_DIR:
+      return CLOUDABI_FILETYPE_DIRECTORY;
+    case DT_FIFO:
+      return CLOUDABI_FILETYPE_FIFO;
+    case DT_LNK:
+      return CLOUDABI_FILETYPE_SYMBOLIC_LINK;
+    case DT_REG:
+      return CLOUDABI_FILETYPE_REGULAR_FILE;
+#ifdef DT_SOCK
+    case DT_SOCK:
+      // Technically not correct, but good enough.
+      return CLOUDABI_FILETYPE_SOCKET_STREAM;
+#endif
+    default:
+      return CLOUDABI_FILETYPE_UNKNOWN;
+  }
+}
+
+#if CONFIG_HAS_GETDENTS64
+// Directory entry, as returned by getdents64().
+struct linux_dirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+// Size of the buffer used to read directory entries in bulk.
+#define FILE_READDIR_BUFSIZE 32768
+#endif
+
 static cloudabi_errno_t file_readdir(cloudabi_fd_t fd, void *buf, size_t nbyte,
                                      cloudabi_dircookie_t cookie,
                                      size_t *bufused) {
@@ -1831,6 +2623,82 @@ static cloudabi_errno_t file_readdir(cloudabi_fd_t fd, void *buf, size_t nbyte,
     return error;
   }
 
+#if CONFIG_HAS_GETDENTS64
+  // Read entries directly from the kernel in batches, instead of going
+  // through a DIR object. The offsets returned by getdents64() can be
+  // used as cookies, as they can be passed to lseek().
+  mutex_lock(&fo->directory.lock);
+  if (fo->directory.buf == NULL) {
+    fo->directory.buf = malloc(FILE_READDIR_BUFSIZE);
+    if (fo->directory.buf == NULL) {
+      mutex_unlock(&fo->directory.lock);
+      fd_object_release(fo);
+      return CLOUDABI_ENOMEM;
+    }
+    // Force a seek, as the file descriptor may be positioned anywhere.
+    fo->directory.buf_pos = 0;
+    fo->directory.buf_len = 0;
+    fo->directory.offset = ~cookie;
+  }
+
+  // Seek to the right position if the requested offset does not match
+  // the current offset. This discards all buffered entries.
+  if (fo->directory.offset != cookie) {
+    if (lseek(fd_number(fo), cookie, SEEK_SET) == -1) {
+      error = convert_errno(errno);
+      mutex_unlock(&fo->directory.lock);
+      fd_object_release(fo);
+      return error;
+    }
+    fo->directory.buf_pos = 0;
+    fo->directory.buf_len = 0;
+    fo->directory.offset = cookie;
+  }
+
+  // Stop as soon as the buffer is full, as the caller will resume
+  // reading at the last entry that was returned in full.
+  *bufused = 0;
+  while (*bufused < nbyte) {
+    // Read the next batch of directory entries if needed.
+    if (fo->directory.buf_pos == fo->directory.buf_len) {
+      ssize_t len = syscall(SYS_getdents64, fd_number(fo), fo->directory.buf,
+                            FILE_READDIR_BUFSIZE);
+      if (len <= 0) {
+        if (len < 0 && *bufused == 0)
+          error = convert_errno(errno);
+        break;
+      }
+      fo->directory.buf_pos = 0;
+      fo->directory.buf_len = len;
+    }
+    const struct linux_dirent64 *de =
+        (const struct linux_dirent64 *)(fo->directory.buf +
+                                        fo->directory.buf_pos);
+
+    // Craft a directory entry and copy that back.
+    size_t namlen = strlen(de->d_name);
+    cloudabi_dirent_t cde = {
+        .d_next = de->d_off,
+        .d_ino = de->d_ino,
+        .d_namlen = namlen,
+        .d_type = file_readdir_type(de->d_type),
+    };
+    size_t bufavail = nbyte - *bufused;
+    file_readdir_put(buf, nbyte, bufused, &cde, sizeof(cde));
+    file_readdir_put(buf, nbyte, bufused, de->d_name, namlen);
+
+    // Only consume entries that have been copied out in full. The
+    // caller will resume reading at a truncated entry, which can then
+    // be returned again without seeking.
+    if (sizeof(cde) + namlen <= bufavail) {
+      fo->directory.buf_pos += de->d_reclen;
+      fo->directory.offset = de->d_off;
+    }
+  }
+  mutex_unlock(&fo->directory.lock);
+  fd_object_release(fo);
+  return error;
+#else
   // Create a directory handle if none has been opened yet.
   mutex_lock(&fo->directory.lock);
   DIR *dp = fo->directory.handle;
@@ -1855,8 +2723,10 @@ static cloudabi_errno_t file_readdir(cloudabi_fd_t fd, void *buf, size_t nbyte,
     fo->directory.offset = cookie;
   }
 
+  // Stop as soon as the buffer is full, as the caller will resume
+  // reading at the last entry that was returned in full.
   *bufused = 0;
-  while (nbyte > 0) {
+  while (*bufused < nbyte) {
     // Read the next directory entry.
     errno = 0;
     struct dirent *de = readdir(dp);
@@ -1870,43 +2740,18 @@ static cloudabi_errno_t file_readdir(cloudabi_fd_t fd, void *buf, size_t nbyte,
     // Craft a directory entry and copy that back.
     size_t namlen = strlen(de->d_name);
     cloudabi_dirent_t cde = {
-        .d_next = fo->directory.offset, .d_ino = de->d_ino, .d_namlen = namlen,
+        .d_next = fo->directory.offset,
+        .d_ino = de->d_ino,
+        .d_namlen = namlen,
+        .d_type = file_readdir_type(de->d_type),
     };
-    switch (de->d_type) {
-      case DT_BLK:
-        cde.d_type = CLOUDABI_FILETYPE_BLOCK_DEVICE;
-        break;
-      case DT_CHR:
-        cde.d_type = CLOUDABI_FILETYPE_CHARACTER_DEVICE;
-        break;
-      case DT_DIR:
-        cde.d_type = CLOUDABI_FILETYPE_DIRECTORY;
-        break;
-      case DT_FIFO:
-        cde.d_type = CLOUDABI_FILETYPE_FIFO;
-        break;
-      case DT_LNK:
-        cde.d_type = CLOUDABI_FILETYPE_SYMBOLIC_LINK;
-        break;
-      case DT_REG:
-        cde.d_type = CLOUDABI_FILETYPE_REGULAR_FILE;
-        break;
-#ifdef DT_SOCK
-      case DT_SOCK:
-        // Technically not correct, but good enough.
-        cde.d_type = CLOUDABI_FILETYPE_SOCKET_STREAM;
-        break;
-#endif
-      default:
-        cde.d_type = CLOUDABI_FILETYPE_UNKNOWN;
-        break;
-    }
     file_readdir_put(buf, nbyte, bufused, &cde, sizeof(cde));
     file_readdir_put(buf, nbyte, bufused, de->d_name, namlen);
   }
   mutex_unlock(&fo->directory.lock);
   fd_object_release(fo);
   return 0;
+#endif
 }
 
 static cloudabi_errno_t file_readlink(cloudabi_fd_t fd, const char *path,
@@ -1980,7 +2825,7 @@ static cloudabi_errno_t file_stat_fget(cloudabi_fd_t fd,
 
   int ret;
   switch (fo->type) {
-#if !CONFIG_HAS_KQUEUE
+#if !CONFIG_HAS_KQUEUE && !CONFIG_HAS_EPOLL
     case CLOUDABI_FILETYPE_POLL:
       // TODO(ed): How can we fill in the other fields?
       *buf = (cloudabi_filestat_t){.st_nlink = 1};
@@ -2241,7 +3086,8 @@ static cloudabi_errno_t file_stat_put(cloudabi_lookup_t fd, const char *path,
 static cloudabi_errno_t file_symlink(const char *path1, size_t path1len,
                                      cloudabi_fd_t fd, const char *path2,
                                      size_t path2len) {
-  char *target = str_nullterminate(path1, path1len);
+  struct scratch_mark sm = scratch_mark();
+  char *target = scratch_nullterminate(path1, path1len);
   if (target == NULL)
     return convert_errno(errno);
 
@@ -2249,13 +3095,13 @@ static cloudabi_errno_t file_symlink(const char *path1, size_t path1len,
   cloudabi_errno_t error = path_get_nofollow(
       &pa, fd, path2, path2len, CLOUDABI_RIGHT_FILE_SYMLINK, 0, true);
   if (error != 0) {
-    free(target);
+    scratch_release(&sm);
     return error;
   }
 
   int ret = symlinkat(target, pa.fd, pa.path);
   path_put(&pa);
-  free(target);
+  scratch_release(&sm);
   if (ret < 0)
     return convert_errno(errno);
   return 0;
@@ -2502,9 +3348,629 @@ static cloudabi_errno_t do_pdwait(cloudabi_fd_t fd, bool nohang,
   return 0;
 }
 
+#if CONFIG_HAS_EPOLL
+
+// Maximum number of events fetched from epoll at once.
+#define POLL_SET_MAXEVENTS 256
+
+// Event file descriptor of the current thread, used to wake it up
+// while it is waiting on both futexes and file descriptors.
+static _Thread_local int curwakeupfd = -1;
+
+// Looks up the registration of a file descriptor in a polling set.
+static struct poll_registration *poll_set_lookup(struct poll_set *ps,
+                                                 cloudabi_fd_t fd)
+    REQUIRES_EXCLUSIVE(ps->lock) {
+  if (ps->nbuckets == 0)
+    return NULL;
+  struct poll_registration *pr;
+  LIST_FOREACH(pr, &ps->buckets[fd & (ps->nbuckets - 1)], bucket) {
+    if (pr->fd == fd)
+      return pr;
+  }
+  return NULL;
+}
+
+// Inserts a new registration into a polling set, growing the hash table
+// to keep the number of registrations per bucket low.
+static bool poll_set_insert(struct poll_set *ps, struct poll_registration *pr)
+    REQUIRES_EXCLUSIVE(ps->lock) {
+  if (ps->count >= ps->nbuckets) {
+    size_t nbuckets = ps->nbuckets == 0 ? 16 : ps->nbuckets * 2;
+    struct poll_bucket *buckets = malloc(nbuckets * sizeof(buckets[0]));
+    if (buckets == NULL)
+      return false;
+    for (size_t i = 0; i < nbuckets; ++i)
+      LIST_INIT(&buckets[i]);
+    for (size_t i = 0; i < ps->nbuckets; ++i) {
+      while (!LIST_EMPTY(&ps->buckets[i])) {
+        struct poll_registration *move = LIST_FIRST(&ps->buckets[i]);
+        LIST_REMOVE(move, bucket);
+        LIST_INSERT_HEAD(&buckets[move->fd & (nbuckets - 1)], move, bucket);
+      }
+    }
+    free(ps->buckets);
+    ps->buckets = buckets;
+    ps->nbuckets = nbuckets;
+  }
+  LIST_INSERT_HEAD(&ps->buckets[pr->fd & (ps->nbuckets - 1)], pr, bucket);
+  ++ps->count;
+  return true;
+}
+
+static void poll_set_remove(struct poll_set *ps, struct poll_registration *pr)
+    REQUIRES_EXCLUSIVE(ps->lock) {
+  LIST_REMOVE(pr, bucket);
+  if (pr->onpending)
+    TAILQ_REMOVE(&ps->pending, pr, pending);
+  --ps->count;
+  free(pr);
+}
+
+// Brings the epoll registration of a file descriptor in sync with its
+// subscriptions. Registrations without any subscriptions are removed
+// and deallocated.
+//
+// epoll only supports edge-triggered and oneshot behaviour per file
+// descriptor. Edge triggering is only used if all enabled subscriptions
+// request it. If any of the subscriptions is oneshot, the file
+// descriptor is registered as oneshot and rearmed after every event,
+// ensuring that events are not returned to multiple threads.
+static cloudabi_errno_t poll_set_update(struct poll_set *ps,
+                                        struct poll_registration *pr)
+    REQUIRES_EXCLUSIVE(ps->lock) {
+  struct epoll_event ev = {.data.u64 = pr->fd};
+  bool edge = true;
+  for (size_t i = 0; i < 2; ++i) {
+    if (pr->filters[i].present && !pr->filters[i].disabled) {
+      ev.events |= i == 0 ? EPOLLIN | EPOLLRDHUP : EPOLLOUT;
+      if ((pr->filters[i].flags & CLOUDABI_SUBSCRIPTION_CLEAR) == 0)
+        edge = false;
+      if ((pr->filters[i].flags & CLOUDABI_SUBSCRIPTION_ONESHOT) != 0)
+        ev.events |= EPOLLONESHOT;
+    }
+  }
+
+  pr->oneshot = (ev.events & EPOLLONESHOT) != 0;
+  if (ev.events == 0) {
+    // No enabled subscriptions. Remove the registration from epoll.
+    if (pr->registered) {
+      epoll_ctl(ps->epfd, EPOLL_CTL_DEL, pr->number, NULL);
+      pr->registered = false;
+    }
+  } else {
+    if (edge)
+      ev.events |= EPOLLET;
+    // The underlying file descriptor may have been closed in the
+    // meantime, meaning epoll has already discarded the registration.
+    if (!pr->registered ||
+        (epoll_ctl(ps->epfd, EPOLL_CTL_MOD, pr->number, &ev) != 0 &&
+         errno == ENOENT)) {
+      if (epoll_ctl(ps->epfd, EPOLL_CTL_ADD, pr->number, &ev) != 0 &&
+          (errno != EEXIST ||
+           epoll_ctl(ps->epfd, EPOLL_CTL_MOD, pr->number, &ev) != 0))
+        return convert_errno(errno);
+      pr->registered = true;
+    }
+  }
+
+  if (!pr->filters[0].present && !pr->filters[1].present)
+    poll_set_remove(ps, pr);
+  return 0;
+}
+
+// Adds, modifies or deletes a read or write subscription on a file
+// descriptor, following the semantics of kqueue.
+static cloudabi_errno_t poll_set_subscribe(struct poll_set *ps,
+                                           const cloudabi_subscription_t *sub,
+                                           cloudabi_subflags_t flags)
+    REQUIRES_EXCLUSIVE(ps->lock) {
+  size_t filter;
+  switch (sub->type) {
+    case CLOUDABI_EVENTTYPE_FD_READ:
+      filter = 0;
+      break;
+    case CLOUDABI_EVENTTYPE_FD_WRITE:
+      filter = 1;
+      break;
+    default:
+      return CLOUDABI_ENOSYS;
+  }
+
+  // Determine the underlying file descriptor number.
+  struct fd_object *fo;
+  cloudabi_errno_t error = fd_object_get(&fo, sub->fd_readwrite.fd,
+                                         CLOUDABI_RIGHT_POLL_FD_READWRITE, 0);
+  if (error != 0)
+    return error;
+  int number = fd_number(fo);
+  fd_object_release(fo);
+
+  struct poll_registration *pr = poll_set_lookup(ps, sub->fd_readwrite.fd);
+  if (pr == NULL) {
+    if ((flags & CLOUDABI_SUBSCRIPTION_ADD) == 0 ||
+        (flags & CLOUDABI_SUBSCRIPTION_DELETE) != 0)
+      return CLOUDABI_ENOENT;
+    pr = malloc(sizeof(*pr));
+    if (pr == NULL)
+      return CLOUDABI_ENOMEM;
+    *pr = (struct poll_registration){
+        .fd = sub->fd_readwrite.fd, .number = number,
+    };
+    if (!poll_set_insert(ps, pr)) {
+      free(pr);
+      return CLOUDABI_ENOMEM;
+    }
+  } else if (pr->number != number) {
+    // File descriptor number got reused for a different file.
+    pr->number = number;
+    pr->registered = false;
+  }
+
+  if ((flags & CLOUDABI_SUBSCRIPTION_DELETE) != 0) {
+    if (!pr->filters[filter].present)
+      return CLOUDABI_ENOENT;
+    pr->filters[filter].present = false;
+    pr->filters[filter].pending = false;
+    return poll_set_update(ps, pr);
+  }
+
+  bool created = false;
+  if (!pr->filters[filter].present) {
+    if ((flags & CLOUDABI_SUBSCRIPTION_ADD) == 0)
+      return CLOUDABI_ENOENT;
+    pr->filters[filter].present = true;
+    pr->filters[filter].disabled = false;
+    created = true;
+  }
+  if ((flags & CLOUDABI_SUBSCRIPTION_ADD) != 0) {
+    pr->filters[filter].flags =
+        flags & (CLOUDABI_SUBSCRIPTION_CLEAR | CLOUDABI_SUBSCRIPTION_ONESHOT);
+    pr->filters[filter].userdata = sub->userdata;
+  }
+  if ((flags & CLOUDABI_SUBSCRIPTION_DISABLE) != 0) {
+    pr->filters[filter].disabled = true;
+    pr->filters[filter].pending = false;
+  }
+  if ((flags & CLOUDABI_SUBSCRIPTION_ENABLE) != 0)
+    pr->filters[filter].disabled = false;
+
+  error = poll_set_update(ps, pr);
+  if (error != 0 && created) {
+    // Roll back the newly created subscription.
+    pr->filters[filter].present = false;
+    poll_set_update(ps, pr);
+  }
+  return error;
+}
+
+// Returns events for the pending subscriptions of a registration, as
+// far as space permits. Registrations with events that did not fit are
+// placed on the pending list, so they are returned by the next call.
+// The registration may be deallocated if it has no subscriptions left.
+static size_t poll_set_emit(struct poll_set *ps, struct poll_registration *pr,
+                            cloudabi_event_t *out, size_t nout)
+    REQUIRES_EXCLUSIVE(ps->lock) {
+  static const cloudabi_eventtype_t types[] = {CLOUDABI_EVENTTYPE_FD_READ,
+                                                CLOUDABI_EVENTTYPE_FD_WRITE};
+  size_t nevents = 0;
+  for (size_t i = 0; i < 2; ++i) {
+    if (!pr->filters[i].pending)
+      continue;
+    if (nevents == nout) {
+      if (!pr->onpending) {
+        TAILQ_INSERT_TAIL(&ps->pending, pr, pending);
+        pr->onpending = true;
+      }
+      return nevents;
+    }
+
+    cloudabi_event_t *ev = &out[nevents++];
+    *ev = (cloudabi_event_t){
+        .userdata = pr->filters[i].userdata,
+        .type = types[i],
+        .fd_readwrite.fd = pr->fd,
+    };
+    if (pr->filters[i].hangup)
+      ev->fd_readwrite.flags |= CLOUDABI_EVENT_FD_READWRITE_HANGUP;
+    if (i == 0) {
+      // epoll does not report the number of bytes available for reading.
+      int nbytes;
+      if (ioctl(pr->number, FIONREAD, &nbytes) == 0 && nbytes > 0)
+        ev->fd_readwrite.nbytes = nbytes;
+    }
+
+    pr->filters[i].pending = false;
+    if ((pr->filters[i].flags & CLOUDABI_SUBSCRIPTION_ONESHOT) != 0)
+      pr->filters[i].present = false;
+  }
+  if (pr->onpending) {
+    TAILQ_REMOVE(&ps->pending, pr, pending);
+    pr->onpending = false;
+  }
+
+  // Oneshot registrations are disabled by epoll after triggering. Rearm
+  // them with the remaining subscriptions once all events are returned.
+  if (pr->oneshot)
+    poll_set_update(ps, pr);
+  return nevents;
+}
+
+// Converts events returned by epoll to CloudABI events.
+static size_t poll_set_translate(struct poll_set *ps,
+                                 const struct epoll_event *events,
+                                 size_t nevents, cloudabi_event_t *out,
+                                 size_t nout) REQUIRES_EXCLUSIVE(ps->lock) {
+  size_t n = 0;
+  for (size_t i = 0; i < nevents; ++i) {
+    // Discard events for registrations that have been removed.
+    struct poll_registration *pr = poll_set_lookup(ps, events[i].data.u64);
+    if (pr == NULL)
+      continue;
+
+    static const uint32_t ready[] = {EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR,
+                                     EPOLLOUT | EPOLLHUP | EPOLLERR};
+    static const uint32_t hangup[] = {EPOLLRDHUP | EPOLLHUP | EPOLLERR,
+                                      EPOLLHUP | EPOLLERR};
+    for (size_t j = 0; j < 2; ++j) {
+      if (pr->filters[j].present && !pr->filters[j].disabled &&
+          (events[i].events & ready[j]) != 0) {
+        pr->filters[j].pending = true;
+        pr->filters[j].hangup = (events[i].events & hangup[j]) != 0;
+      }
+    }
+    n += poll_set_emit(ps, pr, out + n, nout - n);
+  }
+  return n;
+}
+
+// Converts a clock subscription used as a timeout to an absolute
+// deadline. Waits without a timeout have a deadline of UINT64_MAX.
+static cloudabi_errno_t poll_set_deadline(const cloudabi_subscription_t *sub,
+                                          clockid_t *clock_id,
+                                          cloudabi_timestamp_t *deadline) {
+  if (sub == NULL) {
+    *clock_id = CLOCK_MONOTONIC;
+    *deadline = UINT64_MAX;
+    return 0;
+  }
+  if (sub->type != CLOUDABI_EVENTTYPE_CLOCK ||
+      !convert_clockid(sub->clock.clock_id, clock_id))
+    return CLOUDABI_EINVAL;
+  if ((sub->clock.flags & CLOUDABI_SUBSCRIPTION_CLOCK_ABSTIME) != 0) {
+    *deadline = sub->clock.timeout;
+  } else {
+    struct timespec ts;
+    if (clock_gettime(*clock_id, &ts) < 0)
+      return convert_errno(errno);
+    cloudabi_timestamp_t now = convert_timespec(&ts);
+    *deadline = sub->clock.timeout > UINT64_MAX - now
+                    ? UINT64_MAX
+                    : now + sub->clock.timeout;
+  }
+  return 0;
+}
+
+// Computes the timeout in milliseconds for epoll_wait() and poll(),
+// rounding up.
+static int poll_set_timeout(clockid_t clock_id, cloudabi_timestamp_t deadline) {
+  if (deadline == UINT64_MAX)
+    return -1;
+  struct timespec ts;
+  clock_gettime(clock_id, &ts);
+  cloudabi_timestamp_t now = convert_timespec(&ts);
+  if (now >= deadline)
+    return 0;
+  cloudabi_timestamp_t ms = (deadline - now + 999999) / 1000000;
+  return ms > INT_MAX ? INT_MAX : ms;
+}
+
+// Waits for events on a polling set until the deadline has passed.
+// Returns zero events if the deadline has passed without any events
+// being triggered.
+static cloudabi_errno_t poll_set_wait(struct poll_set *ps, clockid_t clock_id,
+                                      cloudabi_timestamp_t deadline,
+                                      cloudabi_event_t *out, size_t nout,
+                                      size_t *nevents) {
+  struct epoll_event events[POLL_SET_MAXEVENTS];
+  for (;;) {
+    // Return events that did not fit during previous calls first.
+    mutex_lock(&ps->lock);
+    size_t n = 0;
+    while (n < nout && !TAILQ_EMPTY(&ps->pending))
+      n += poll_set_emit(ps, TAILQ_FIRST(&ps->pending), out + n, nout - n);
+    mutex_unlock(&ps->lock);
+    if (n > 0) {
+      *nevents = n;
+      return 0;
+    }
+
+    int timeout = poll_set_timeout(clock_id, deadline);
+    int ret = epoll_wait(ps->epfd, events,
+                         nout < POLL_SET_MAXEVENTS ? nout : POLL_SET_MAXEVENTS,
+                         timeout);
+    if (ret < 0) {
+      if (errno == EINTR)
+        continue;
+      return convert_errno(errno);
+    }
+
+    mutex_lock(&ps->lock);
+    n = poll_set_translate(ps, events, ret, out, nout);
+    mutex_unlock(&ps->lock);
+    if (n > 0 || timeout == 0) {
+      *nevents = n;
+      return 0;
+    }
+  }
+}
+
+// glibc only declares POLLRDHUP if _GNU_SOURCE is defined.
+#ifndef POLLRDHUP
+#define POLLRDHUP 0x2000
+#endif
+
+// Number of subscriptions that poll_fds() can handle without allocating
+// memory.
+#define POLL_FDS_INLINE 16
+
+// File descriptors of a one-shot poll(), in the form expected by the
+// host's poll(). Every subscription gets an entry of its own, so that
+// multiple subscriptions on the same file descriptor and event type all
+// trigger. The event file descriptor of the thread may follow the
+// entries of the subscriptions.
+struct poll_fds {
+  struct pollfd *pfds;                   // Entries passed to poll().
+  const cloudabi_subscription_t **subs;  // Subscriptions of the entries.
+  size_t nfds;                           // Number of subscriptions.
+  size_t npfds;                          // Number of entries.
+};
+
+// Adds a read or write subscription to a set of file descriptors.
+static cloudabi_errno_t poll_fds_add(struct poll_fds *pf,
+                                     const cloudabi_subscription_t *sub) {
+  short events;
+  switch (sub->type) {
+    case CLOUDABI_EVENTTYPE_FD_READ:
+      events = POLLIN | POLLRDHUP;
+      break;
+    case CLOUDABI_EVENTTYPE_FD_WRITE:
+      events = POLLOUT;
+      break;
+    default:
+      return CLOUDABI_ENOSYS;
+  }
+
+  struct fd_object *fo;
+  cloudabi_errno_t error = fd_object_get(&fo, sub->fd_readwrite.fd,
+                                         CLOUDABI_RIGHT_POLL_FD_READWRITE, 0);
+  if (error != 0)
+    return error;
+  pf->pfds[pf->nfds] = (struct pollfd){.fd = fd_number(fo), .events = events};
+  pf->subs[pf->nfds++] = sub;
+  fd_object_release(fo);
+  return 0;
+}
+
+// Waits for events on a set of file descriptors until the deadline has
+// passed or until the thread is woken up through its event file
+// descriptor. Returns zero events if the deadline has passed without
+// any events being triggered.
+static cloudabi_errno_t poll_fds_wait(struct poll_fds *pf, clockid_t clock_id,
+                                      cloudabi_timestamp_t deadline,
+                                      cloudabi_event_t *out, size_t *nevents,
+                                      bool *woken) {
+  for (;;) {
+    int timeout = poll_set_timeout(clock_id, deadline);
+    if (host_poll(pf->pfds, pf->npfds, timeout) < 0) {
+      if (errno == EINTR)
+        continue;
+      return convert_errno(errno);
+    }
+
+    size_t n = 0;
+    for (size_t i = 0; i < pf->nfds; ++i) {
+      short revents = pf->pfds[i].revents;
+      if (revents == 0)
+        continue;
+      const cloudabi_subscription_t *sub = pf->subs[i];
+      cloudabi_event_t *ev = &out[n++];
+      *ev = (cloudabi_event_t){
+          .userdata = sub->userdata,
+          .type = sub->type,
+          .fd_readwrite.fd = sub->fd_readwrite.fd,
+      };
+      if ((revents & POLLNVAL) != 0)
+        ev->error = CLOUDABI_EBADF;
+      else if ((revents & (POLLRDHUP | POLLHUP | POLLERR)) != 0)
+        ev->fd_readwrite.flags |= CLOUDABI_EVENT_FD_READWRITE_HANGUP;
+    }
+    if (pf->npfds > pf->nfds && pf->pfds[pf->nfds].revents != 0) {
+      // Thread got woken up. Reset the event file descriptor. It is
+      // nonblocking, so a failing read means it was already reset.
+      uint64_t value;
+      while (read(pf->pfds[pf->nfds].fd, &value, sizeof(value)) < 0 &&
+             errno == EINTR) {
+      }
+      *woken = true;
+    }
+    if (n > 0 || timeout == 0 || *woken) {
+      *nevents = n;
+      return 0;
+    }
+  }
+}
+
+// State of a thread waiting on both a futex and file descriptors.
+struct poll_fds_wait {
+  struct poll_fds *pf;     // File descriptors to wait on.
+  int wakeupfd;            // Event file descriptor of the thread.
+  cloudabi_event_t *out;   // Buffer for file descriptor events.
+  size_t nevents;          // Number of file descriptor events returned.
+  cloudabi_errno_t error;  // Error that occurred while waiting.
+};
+
+// Blocks on the file descriptors and the event file descriptor of the
+// thread, on behalf of the futex code.
+static bool poll_fds_block(void *arg, cloudabi_clockid_t clock_id,
+                           cloudabi_timestamp_t timeout) {
+  struct poll_fds_wait *pfw = arg;
+  clockid_t nclock_id;
+  if (!convert_clockid(clock_id, &nclock_id)) {
+    pfw->error = CLOUDABI_EINVAL;
+    return true;
+  }
+  bool woken = false;
+  pfw->nevents = 0;
+  pfw->error = poll_fds_wait(pfw->pf, nclock_id, timeout, pfw->out,
+                             &pfw->nevents, &woken);
+  return pfw->error != 0 || !woken || pfw->nevents > 0;
+}
+
+// Wakes up a thread blocked in poll_fds_block().
+static void poll_fds_wake(void *arg) {
+  struct poll_fds_wait *pfw = arg;
+  uint64_t value = 1;
+  // The event file descriptor is nonblocking. Writes can only fail with
+  // EAGAIN if its counter is about to overflow, in which case the thread
+  // is already guaranteed to wake up.
+  while (write(pfw->wakeupfd, &value, sizeof(value)) < 0 && errno == EINTR) {
+  }
+}
+
+// Polls on a set of file descriptors, with an optional clock
+// subscription acting as a timeout. Unlike poll_fd(), this uses the
+// host's poll(), as setting up an epoll instance for a single call
+// would be more expensive.
+//
+// The set of subscriptions may also contain a single futex event.
+// Wakeups of the futex are then delivered through an event file
+// descriptor that is polled alongside the other file descriptors. Like
+// timeouts, file descriptor events cancel a wait on a condition
+// variable, but still cause the lock to be reacquired.
+static cloudabi_errno_t poll_fds(const cloudabi_subscription_t *in,
+                                 cloudabi_event_t *out, size_t nsubscriptions,
+                                 size_t *nevents) {
+  const cloudabi_subscription_t *timeout = NULL;
+  const cloudabi_subscription_t *futex = NULL;
+  for (size_t i = 0; i < nsubscriptions; ++i) {
+    switch (in[i].type) {
+      case CLOUDABI_EVENTTYPE_CLOCK:
+        if (timeout != NULL) {
+          fputs("Unimplemented poll() on multiple clocks\n", stderr);
+          return CLOUDABI_ENOSYS;
+        }
+        timeout = &in[i];
+        break;
+      case CLOUDABI_EVENTTYPE_CONDVAR:
+      case CLOUDABI_EVENTTYPE_LOCK_RDLOCK:
+      case CLOUDABI_EVENTTYPE_LOCK_WRLOCK:
+        if (futex != NULL) {
+          fputs("Unimplemented poll() on multiple futexes\n", stderr);
+          return CLOUDABI_ENOSYS;
+        }
+        futex = &in[i];
+        break;
+    }
+  }
+  clockid_t clock_id;
+  cloudabi_timestamp_t deadline;
+  cloudabi_errno_t error = poll_set_deadline(timeout, &clock_id, &deadline);
+  if (error != 0)
+    return error;
+
+  // Reserve an additional entry for the event file descriptor.
+  struct pollfd pfds[POLL_FDS_INLINE + 1];
+  const cloudabi_subscription_t *subs[POLL_FDS_INLINE];
+  struct poll_fds pf = {.pfds = pfds, .subs = subs};
+  if (nsubscriptions > POLL_FDS_INLINE) {
+    pf.pfds = malloc((nsubscriptions + 1) * sizeof(pf.pfds[0]));
+    pf.subs = malloc(nsubscriptions * sizeof(pf.subs[0]));
+    if (pf.pfds == NULL || pf.subs == NULL) {
+      free(pf.pfds);
+      free(pf.subs);
+      return CLOUDABI_ENOMEM;
+    }
+  }
+
+  // Add all file descriptors. Failures are returned as events.
+  size_t n = 0;
+  for (size_t i = 0; i < nsubscriptions; ++i) {
+    if (&in[i] == timeout || &in[i] == futex)
+      continue;
+    error = poll_fds_add(&pf, &in[i]);
+    if (error != 0) {
+      out[n] = (cloudabi_event_t){
+          .userdata = in[i].userdata, .error = error, .type = in[i].type,
+      };
+      if (in[i].type == CLOUDABI_EVENTTYPE_FD_READ ||
+          in[i].type == CLOUDABI_EVENTTYPE_FD_WRITE)
+        out[n].fd_readwrite.fd = in[i].fd_readwrite.fd;
+      ++n;
+    }
+  }
+  pf.npfds = pf.nfds;
+
+  error = 0;
+  if (n == 0 && futex != NULL) {
+    if (curwakeupfd < 0)
+      curwakeupfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (curwakeupfd < 0) {
+      error = convert_errno(errno);
+    } else {
+      // Let the futex code block on the file descriptors and the event
+      // file descriptor of the thread. Place the futex event in front
+      // of the file descriptor events.
+      pf.pfds[pf.npfds++] =
+          (struct pollfd){.fd = curwakeupfd, .events = POLLIN};
+      struct poll_fds_wait pfw = {
+          .pf = &pf, .wakeupfd = curwakeupfd, .out = out + 1,
+      };
+      struct futex_poll_hook hook = {
+          .block = poll_fds_block, .wake = poll_fds_wake, .arg = &pfw,
+      };
+      if (futex_op_poll_hook(curtid, futex,
+                             timeout != NULL ? timeout->clock.clock_id
+                                             : CLOUDABI_CLOCK_MONOTONIC,
+                             deadline, &hook, out)) {
+        n = 1 + pfw.nevents;
+      } else {
+        n = pfw.nevents;
+        memmove(out, out + 1, n * sizeof(out[0]));
+      }
+      error = pfw.error;
+    }
+  } else if (n == 0) {
+    bool woken = false;
+    error = poll_fds_wait(&pf, clock_id, deadline, out, &n, &woken);
+  }
+  if (error == 0 && n == 0 && timeout != NULL) {
+    // Timeout has passed. Return the clock event.
+    out[n++] = (cloudabi_event_t){
+        .userdata = timeout->userdata,
+        .type = timeout->type,
+        .clock.identifier = timeout->clock.identifier,
+    };
+  }
+  if (pf.pfds != pfds) {
+    free(pf.pfds);
+    free(pf.subs);
+  }
+  *nevents = n;
+  return error;
+}
+
+#endif
+
 static cloudabi_errno_t poll(const cloudabi_subscription_t *in,
                              cloudabi_event_t *out, size_t nsubscriptions,
                              size_t *nevents) {
+  // Nothing to wait on. Return immediately, instead of blocking forever.
+  if (nsubscriptions == 0) {
+    *nevents = 0;
+    return 0;
+  }
+
   // Capture poll() calls that deal with futexes.
   if (futex_op_poll(curtid, in, out, nsubscriptions, nevents))
     return 0;
@@ -2602,8 +4068,13 @@ static cloudabi_errno_t poll(const cloudabi_subscription_t *in,
     return 0;
   }
 
+#if CONFIG_HAS_EPOLL
+  // Waiting on file descriptors.
+  return poll_fds(in, out, nsubscriptions, nevents);
+#else
   fputs("Unimplemented poll()\n", stderr);
   return CLOUDABI_ENOSYS;
+#endif
 }
 
 static cloudabi_errno_t poll_fd(cloudabi_fd_t fd,
@@ -2611,8 +4082,54 @@ static cloudabi_errno_t poll_fd(cloudabi_fd_t fd,
                                 cloudabi_event_t *out, size_t nout,
                                 const cloudabi_subscription_t *timeout,
                                 size_t *nevents) {
+#if CONFIG_HAS_EPOLL
+  clockid_t clock_id;
+  cloudabi_timestamp_t deadline;
+  cloudabi_errno_t error = poll_set_deadline(timeout, &clock_id, &deadline);
+  if (error != 0)
+    return error;
+
+  struct fd_object *fo;
+  error = fd_object_get(&fo, fd,
+                        (nin > 0 ? CLOUDABI_RIGHT_POLL_MODIFY : 0) |
+                            (nout > 0 ? CLOUDABI_RIGHT_POLL_WAIT : 0),
+                        0);
+  if (error != 0)
+    return error;
+  if (fo->type != CLOUDABI_FILETYPE_POLL) {
+    fd_object_release(fo);
+    return CLOUDABI_EINVAL;
+  }
+
+  // Apply changes to the set of subscriptions. Like kqueue, failures
+  // are returned as events and prevent the call from blocking.
+  struct poll_set *ps = &fo->poll;
+  size_t n = 0;
+  mutex_lock(&ps->lock);
+  for (size_t i = 0; i < nin; ++i) {
+    error = poll_set_subscribe(ps, &in[i], in[i].flags);
+    if (error != 0 && n < nout) {
+      out[n] = (cloudabi_event_t){
+          .userdata = in[i].userdata, .error = error, .type = in[i].type,
+      };
+      if (in[i].type == CLOUDABI_EVENTTYPE_FD_READ ||
+          in[i].type == CLOUDABI_EVENTTYPE_FD_WRITE)
+        out[n].fd_readwrite.fd = in[i].fd_readwrite.fd;
+      ++n;
+    }
+  }
+  mutex_unlock(&ps->lock);
+
+  error = 0;
+  if (n == 0 && nout > 0)
+    error = poll_set_wait(ps, clock_id, deadline, out, nout, &n);
+  fd_object_release(fo);
+  *nevents = n;
+  return error;
+#else
   fputs("Unimplemented poll_fd()\n", stderr);
   return CLOUDABI_ENOSYS;
+#endif
 }
 
 static cloudabi_errno_t proc_exec(cloudabi_fd_t fd, const void *data,
@@ -2623,6 +4140,7 @@ static cloudabi_errno_t proc_exec(cloudabi_fd_t fd, const void *data,
 }
 
 static void proc_exit(cloudabi_exitcode_t rval) {
+  profile_write();
   _Exit(rval);
 }
 
@@ -2647,8 +4165,18 @@ static cloudabi_errno_t proc_fork(cloudabi_fd_t *fd, cloudabi_tid_t *tid) {
     mutex_init(&cwd_lock);
 #endif
     *fd = CLOUDABI_PROCESS_CHILD;
+#if CONFIG_HAS_EPOLL
+    // Don't share the event file descriptor used for wakeups.
+    if (curwakeupfd >= 0) {
+      close(curwakeupfd);
+      curwakeupfd = -1;
+    }
+#endif
+    atomic_store_explicit(&posix_threads, 1, memory_order_relaxed);
     tidpool_postfork();
     futex_postfork();
+    epoch_postfork();
+    random_postfork();
     *tid = tidpool_allocate();
     return 0;
   } else {
@@ -2745,19 +4273,12 @@ static cloudabi_errno_t sock_accept(cloudabi_fd_t sock,
                                     cloudabi_sockstat_t *buf,
                                     cloudabi_fd_t *conn) {
   // Fetch socket file descriptor and rights.
-  struct fd_table *ft = curfds;
-  rwlock_wrlock(&ft->lock);
-  struct fd_entry *fe;
-  cloudabi_errno_t error =
-      fd_table_get_entry(ft, sock, CLOUDABI_RIGHT_SOCK_ACCEPT, 0, &fe);
-  if (error != 0) {
-    rwlock_unlock(&ft->lock);
+  struct fd_object *fo;
+  cloudabi_rights_t base, rights;
+  cloudabi_errno_t error = fd_object_get_rights(
+      &fo, sock, CLOUDABI_RIGHT_SOCK_ACCEPT, 0, &base, &rights);
+  if (error != 0)
     return error;
-  }
-  cloudabi_rights_t rights = fe->rights_inheriting;
-  struct fd_object *fo = fe->object;
-  refcount_acquire(&fo->refcount);
-  rwlock_unlock(&ft->lock);
   cloudabi_filetype_t type = fo->type;
 
   int nfd;
@@ -3065,6 +4586,7 @@ struct thread_params {
   cloudabi_tid_t tid;
   void *argument;
   struct fd_table *fd_table;
+  const cloudabi_syscalls_t *forward;
 };
 
 static void *thread_entry(void *thunk) {
@@ -3073,8 +4595,9 @@ static void *thread_entry(void *thunk) {
 
   curfds = params.fd_table;
   curtid = params.tid;
+  profile_thread_start();
   struct tls tls;
-  tls_init(&tls, &posix_syscalls);
+  tls_init(&tls, params.forward);
 
   // Pass on execution to the thread's entry point. It should never
   // return, but call thread_exit() instead.
@@ -3093,6 +4616,9 @@ static cloudabi_errno_t thread_create(cloudabi_threadattr_t *attr,
   params->tid = *tid = tidpool_allocate();
   params->argument = attr->argument;
   params->fd_table = curfds;
+  // Let the thread use the same system call table as the calling
+  // thread, so that interposers like stats_syscalls see all threads.
+  params->forward = tls_forward_get();
 
   pthread_attr_t nattr;
   int ret = pthread_attr_init(&nattr);
@@ -3116,11 +4642,14 @@ static cloudabi_errno_t thread_create(cloudabi_threadattr_t *attr,
   // we're still shutting down.
   pthread_attr_setstacksize(&nattr, attr->stack_size);
 
-  // Spawn a new thread.
+  // Spawn a new thread. Account for it up front, as it may terminate
+  // before pthread_create() returns.
+  atomic_fetch_add_explicit(&posix_threads, 1, memory_order_relaxed);
   pthread_t thread;
   ret = pthread_create(&thread, &nattr, thread_entry, params);
   pthread_attr_destroy(&nattr);
   if (ret != 0) {
+    atomic_fetch_sub_explicit(&posix_threads, 1, memory_order_relaxed);
     free(params);
     return convert_errno(ret);
   }
@@ -3132,7 +4661,18 @@ static void thread_exit(_Atomic(cloudabi_lock_t) * lock,
   // Drop the lock, so threads waiting to join this thread get woken up.
   futex_op_lock_unlock(curtid, lock, scope);
 
+#if CONFIG_HAS_EPOLL
+  if (curwakeupfd >= 0)
+    close(curwakeupfd);
+#endif
+  epoch_thread_exit();
+  profile_thread_exit();
+  scratch_thread_exit();
+  while (fd_object_cached > 0)
+    free(fd_object_cache[--fd_object_cached]);
+
   // Terminate the execution of this thread.
+  atomic_fetch_sub_explicit(&posix_threads, 1, memory_order_relaxed);
   pthread_exit(NULL);
 }
 
@@ -3142,8 +4682,9 @@ static cloudabi_errno_t thread_tcb_set(void *tcb) {
 }
 
 static cloudabi_errno_t thread_yield(void) {
+  // Invoked without switching TLS areas. See clock_time_get().
   if (sched_yield() < 0)
-    return convert_errno(errno);
+    return CLOUDABI_EINVAL;
   return 0;
 }
 
@@ -6,8 +6,10 @@
 #ifndef POSIX_H
 #define POSIX_H
 
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include <cloudabi_syscalls_struct.h>
 
@@ -15,11 +17,14 @@
 
 struct fd_entry;
 
+// File descriptor table. Lookups are lock-free, while modifications
+// are serialized through the lock.
 struct fd_table {
   struct rwlock lock;
-  struct fd_entry *entries;
-  size_t size;
+  _Atomic(struct fd_entry *) entries;
+  _Atomic(size_t) size;
   size_t used;
+  uint64_t *slots;  // Bitmap of entries in use.
 };
 
 extern _Thread_local cloudabi_tid_t curtid;
@@ -29,4 +34,23 @@ extern cloudabi_syscalls_t posix_syscalls;
 void fd_table_init(struct fd_table *);
 bool fd_table_insert_existing(struct fd_table *, cloudabi_fd_t, int);
 
+// Number of heap allocations made on behalf of system calls. As file
+// descriptor objects and pathname buffers are recycled, these counters
+// should remain constant in a steady state.
+struct posix_allocstats {
+  uint64_t fd_objects;      // File descriptor objects.
+  uint64_t scratch_chunks;  // Chunks of scratch memory for pathnames.
+};
+
+void posix_allocstats_get(struct posix_allocstats *);
+
+// Resource usage of the emulated process.
+struct posix_usage {
+  size_t fds_size;       // Size of the file descriptor table.
+  size_t fds_used;       // Number of file descriptors in use.
+  unsigned int threads;  // Number of threads.
+};
+
+void posix_usage_get(struct fd_table *, struct posix_usage *);
+
 #endif
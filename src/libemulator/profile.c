@@ -0,0 +1,363 @@
+// Copyright (c) 2016 Nuxi, https://nuxi.nl/
+//
+// This file is distributed under a 2-clause BSD license.
+// See the LICENSE file for details.
+
+// Needed for pthread_getattr_np() and the register names of ucontext_t.
+#define _GNU_SOURCE
+
+#include "config.h"
+
+#if CONFIG_HAS_SIGEV_THREAD_ID
+#include <sys/syscall.h>
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "profile.h"
+#include "symbols.h"
+
+#if CONFIG_HAS_SIGEV_THREAD_ID
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+// Registers holding the program counter and the frame pointer.
+#if defined(__aarch64__)
+#define PROFILE_PC(uc) ((uc)->uc_mcontext.pc)
+#define PROFILE_FP(uc) ((uc)->uc_mcontext.regs[29])
+#elif defined(__x86_64__)
+#define PROFILE_PC(uc) ((uc)->uc_mcontext.gregs[REG_RIP])
+#define PROFILE_FP(uc) ((uc)->uc_mcontext.gregs[REG_RBP])
+#else
+#error "Unsupported architecture"
+#endif
+
+// Sampling frequency, in samples per second of CPU time.
+#define PROFILE_HZ 1000
+
+// Maximum number of frames recorded per sample.
+#define PROFILE_MAXDEPTH 64
+
+// Number of distinct call stacks that can be stored per thread, and the
+// number of slots probed before giving up.
+#define PROFILE_NSTACKS 2048
+#define PROFILE_NPROBES 16
+
+// A call stack and the number of times it was observed.
+struct profile_stack {
+  _Atomic(uint64_t) count;          // Number of samples, or zero if unused.
+  uint32_t hash;                    // Hash of the program counters.
+  uint32_t depth;                   // Number of frames.
+  uintptr_t pcs[PROFILE_MAXDEPTH];  // Program counters, innermost first.
+};
+
+// Per-thread samples. They are only written by the signal handler of
+// the thread owning the record, so that sampling requires no locking.
+// Records are never freed, as their samples are written when the
+// process terminates, but are recycled once the thread owning them has
+// terminated.
+struct profile_record {
+  struct profile_stack stacks[PROFILE_NSTACKS];
+  _Atomic(uint64_t) dropped;  // Samples for which no slot was free.
+  uintptr_t stack_begin;      // Bounds of the stack of the thread.
+  uintptr_t stack_end;
+  timer_t timer;              // Timer generating the samples.
+  _Atomic(bool) used;         // Owned by a thread.
+  struct profile_record *next;
+};
+
+// List of all records. Records are only ever prepended.
+static _Atomic(struct profile_record *) profile_records = NULL;
+static _Thread_local struct profile_record *profile_self = NULL;
+
+static bool profile_active = false;
+static FILE *profile_out;
+static const struct symbols *profile_symbols;
+static uintptr_t profile_image_begin;
+static uintptr_t profile_image_end;
+static pid_t profile_pid;
+
+// Records a sample of the interrupted thread. As the thread may be
+// executing code of the executable, which uses a TLS area of its own,
+// this function may not access any thread-local variables. The record
+// of the thread is therefore passed along through the timer.
+static void profile_sample(int sig, siginfo_t *si, void *ucp) {
+  struct profile_record *pr = si->si_value.sival_ptr;
+  if (si->si_code != SI_TIMER || pr == NULL)
+    return;
+
+  // Walk the chain of frame pointers. Only follow frames that are
+  // stored on the stack of the thread, each one above the previous
+  // one, so that garbage in the frame pointer register cannot cause
+  // invalid memory accesses or endless loops.
+  ucontext_t *uc = ucp;
+  uintptr_t pcs[PROFILE_MAXDEPTH];
+  uint32_t depth = 0;
+  pcs[depth++] = PROFILE_PC(uc);
+  uintptr_t fp = PROFILE_FP(uc);
+  while (depth < PROFILE_MAXDEPTH && fp % sizeof(uintptr_t) == 0 &&
+         fp >= pr->stack_begin && fp + 2 * sizeof(uintptr_t) <= pr->stack_end) {
+    const uintptr_t *frame = (const uintptr_t *)fp;
+    if (frame[1] == 0)
+      break;
+    pcs[depth++] = frame[1];
+    if (frame[0] <= fp)
+      break;
+    fp = frame[0];
+  }
+
+  // Count the call stack in the hash table of the thread.
+  uint32_t hash = 2166136261;
+  for (uint32_t i = 0; i < depth; ++i)
+    hash = (hash ^ pcs[i]) * 16777619;
+  for (uint32_t i = 0; i < PROFILE_NPROBES; ++i) {
+    struct profile_stack *ps = &pr->stacks[(hash + i) % PROFILE_NSTACKS];
+    uint64_t count = atomic_load_explicit(&ps->count, memory_order_relaxed);
+    if (count == 0) {
+      ps->hash = hash;
+      ps->depth = depth;
+      memcpy(ps->pcs, pcs, depth * sizeof(pcs[0]));
+      atomic_store_explicit(&ps->count, 1, memory_order_release);
+      return;
+    }
+    if (ps->hash == hash && ps->depth == depth &&
+        memcmp(ps->pcs, pcs, depth * sizeof(pcs[0])) == 0) {
+      atomic_store_explicit(&ps->count, count + 1, memory_order_relaxed);
+      return;
+    }
+  }
+  atomic_store_explicit(
+      &pr->dropped,
+      atomic_load_explicit(&pr->dropped, memory_order_relaxed) + 1,
+      memory_order_relaxed);
+}
+
+// Returns the record of the calling thread, allocating one if needed.
+static struct profile_record *profile_record_get(void) {
+  // Recycle a record of a thread that has terminated.
+  struct profile_record *pr;
+  for (pr = atomic_load_explicit(&profile_records, memory_order_acquire);
+       pr != NULL; pr = pr->next) {
+    bool used = false;
+    if (!atomic_load_explicit(&pr->used, memory_order_relaxed) &&
+        atomic_compare_exchange_strong_explicit(&pr->used, &used, true,
+                                                memory_order_acquire,
+                                                memory_order_relaxed))
+      return pr;
+  }
+
+  // Allocate a new record and prepend it to the list. Only the parts
+  // of the hash table that are used end up being backed by memory.
+  pr = calloc(1, sizeof(*pr));
+  if (pr == NULL)
+    return NULL;
+  atomic_init(&pr->used, true);
+  pr->next = atomic_load_explicit(&profile_records, memory_order_relaxed);
+  while (!atomic_compare_exchange_weak_explicit(&profile_records, &pr->next,
+                                                pr, memory_order_release,
+                                                memory_order_relaxed))
+    ;
+  return pr;
+}
+
+void profile_thread_start(void) {
+  if (!profile_active)
+    return;
+  struct profile_record *pr = profile_record_get();
+  if (pr == NULL)
+    return;
+
+  // Determine the bounds of the stack of the thread.
+  pthread_attr_t attr;
+  void *stack;
+  size_t stacksize;
+  if (pthread_getattr_np(pthread_self(), &attr) != 0)
+    goto release;
+  int ret = pthread_attr_getstack(&attr, &stack, &stacksize);
+  pthread_attr_destroy(&attr);
+  if (ret != 0)
+    goto release;
+  pr->stack_begin = (uintptr_t)stack;
+  pr->stack_end = (uintptr_t)stack + stacksize;
+
+  // Let a timer send SIGPROF to this thread based on the CPU time it
+  // consumes, passing along the record.
+  struct sigevent sev = {
+      .sigev_notify = SIGEV_THREAD_ID,
+      .sigev_signo = SIGPROF,
+      .sigev_value.sival_ptr = pr,
+  };
+  sev.sigev_notify_thread_id = syscall(SYS_gettid);
+  if (timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &pr->timer) != 0)
+    goto release;
+  struct itimerspec its = {
+      .it_interval = {.tv_nsec = 1000000000 / PROFILE_HZ},
+      .it_value = {.tv_nsec = 1000000000 / PROFILE_HZ},
+  };
+  if (timer_settime(pr->timer, 0, &its, NULL) != 0) {
+    timer_delete(pr->timer);
+    goto release;
+  }
+  profile_self = pr;
+  return;
+
+release:
+  atomic_store_explicit(&pr->used, false, memory_order_release);
+}
+
+void profile_thread_exit(void) {
+  struct profile_record *pr = profile_self;
+  if (pr != NULL) {
+    timer_delete(pr->timer);
+    profile_self = NULL;
+    atomic_store_explicit(&pr->used, false, memory_order_release);
+  }
+}
+
+bool profile_start(FILE *out, const struct symbols *symbols,
+                   uintptr_t image_begin, uintptr_t image_end) {
+  profile_out = out;
+  profile_symbols = symbols;
+  profile_image_begin = image_begin;
+  profile_image_end = image_end;
+  profile_pid = getpid();
+
+  struct sigaction sa = {
+      .sa_sigaction = profile_sample, .sa_flags = SA_SIGINFO | SA_RESTART,
+  };
+  sigemptyset(&sa.sa_mask);
+  if (sigaction(SIGPROF, &sa, NULL) != 0)
+    return false;
+  profile_active = true;
+  profile_thread_start();
+  return true;
+}
+
+// A symbolized call stack.
+struct profile_line {
+  char *frames;    // Names of all frames, separated by semicolons.
+  uint64_t count;  // Number of samples.
+};
+
+static int profile_line_compare(const void *a, const void *b) {
+  const struct profile_line *pla = a, *plb = b;
+  return strcmp(pla->frames, plb->frames);
+}
+
+// Converts a call stack to a string of frames, outermost first.
+static char *profile_fold(const struct profile_stack *ps) {
+  char *frames;
+  size_t len;
+  FILE *f = open_memstream(&frames, &len);
+  if (f == NULL)
+    return NULL;
+  bool in_emulator = false;
+  for (uint32_t i = ps->depth; i-- > 0;) {
+    // Return addresses point to the instruction following the call.
+    uintptr_t pc = i > 0 ? ps->pcs[i] - 1 : ps->pcs[i];
+    const char *separator = i + 1 < ps->depth ? ";" : "";
+    if (pc < profile_image_begin || pc >= profile_image_end) {
+      // Code of the emulator itself, or of the system call functions
+      // provided to the executable. Merge consecutive frames.
+      if (!in_emulator)
+        fprintf(f, "%s[emulator]", separator);
+      in_emulator = true;
+    } else {
+      const struct symbol *symbol = symbols_lookup(profile_symbols, pc);
+      if (symbol != NULL)
+        fprintf(f, "%s%s", separator, symbol->name);
+      else
+        fprintf(f, "%s0x%jx", separator, (uintmax_t)pc);
+      in_emulator = false;
+    }
+  }
+  if (fclose(f) != 0)
+    return NULL;
+  return frames;
+}
+
+void profile_write(void) {
+  // Only write samples for the process that enabled profiling, not for
+  // any children it has forked.
+  if (!profile_active || getpid() != profile_pid)
+    return;
+  profile_thread_exit();
+
+  // Symbolize the call stacks of all threads.
+  size_t nlines = 0, maxlines = 0;
+  struct profile_line *lines = NULL;
+  uint64_t dropped = 0;
+  for (struct profile_record *pr =
+           atomic_load_explicit(&profile_records, memory_order_acquire);
+       pr != NULL; pr = pr->next) {
+    dropped += atomic_load_explicit(&pr->dropped, memory_order_relaxed);
+    for (size_t i = 0; i < PROFILE_NSTACKS; ++i) {
+      const struct profile_stack *ps = &pr->stacks[i];
+      uint64_t count = atomic_load_explicit(&ps->count, memory_order_acquire);
+      if (count == 0)
+        continue;
+      if (nlines == maxlines) {
+        maxlines = maxlines == 0 ? 256 : maxlines * 2;
+        struct profile_line *nl = realloc(lines, maxlines * sizeof(*lines));
+        if (nl == NULL)
+          goto done;
+        lines = nl;
+      }
+      char *frames = profile_fold(ps);
+      if (frames == NULL)
+        goto done;
+      lines[nlines++] = (struct profile_line){.frames = frames, .count = count};
+    }
+  }
+
+  // Merge identical call stacks observed by different threads.
+  qsort(lines, nlines, sizeof(*lines), profile_line_compare);
+  for (size_t i = 0; i < nlines;) {
+    uint64_t count = 0;
+    size_t j = i;
+    do {
+      count += lines[j++].count;
+    } while (j < nlines && strcmp(lines[i].frames, lines[j].frames) == 0);
+    fprintf(profile_out, "%s %ju\n", lines[i].frames, (uintmax_t)count);
+    i = j;
+  }
+  if (dropped > 0)
+    fprintf(profile_out, "[dropped] %ju\n", (uintmax_t)dropped);
+
+done:
+  fflush(profile_out);
+  for (size_t i = 0; i < nlines; ++i)
+    free(lines[i].frames);
+  free(lines);
+}
+
+#else
+
+bool profile_start(FILE *out, const struct symbols *symbols,
+                   uintptr_t image_begin, uintptr_t image_end) {
+  errno = ENOSYS;
+  return false;
+}
+
+void profile_thread_start(void) {
+}
+
+void profile_thread_exit(void) {
+}
+
+void profile_write(void) {
+}
+
+#endif
@@ -0,0 +1,39 @@
+// Copyright (c) 2016 Nuxi, https://nuxi.nl/
+//
+// This file is distributed under a 2-clause BSD license.
+// See the LICENSE file for details.
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+struct symbols;
+
+// Sampling profiler for emulated executables.
+//
+// Every thread of the executable is interrupted periodically, based on
+// the CPU time it consumes. The signal handler walks the frame pointer
+// chain of the interrupted code and counts the number of times every
+// call stack was observed. When the process terminates, the call stacks
+// are symbolized and written in the folded format used by tools like
+// FlameGraph, one call stack per line.
+
+// Starts profiling the calling thread, and any threads it creates.
+// Call stacks are symbolized using the symbols of the executable, which
+// is mapped in the range of addresses provided. Returns false if the
+// profiler could not be started, or is not supported on this system.
+bool profile_start(FILE *, const struct symbols *, uintptr_t, uintptr_t);
+
+// Should be invoked by threads after they start and before they
+// terminate, respectively.
+void profile_thread_start(void);
+void profile_thread_exit(void);
+
+// Writes the call stacks observed so far. Should be invoked when the
+// process terminates.
+void profile_write(void);
+
+#endif
@@ -23,6 +23,8 @@
     struct type **l_prev; \
   }
 
+#define LIST_EMPTY(head) ((head)->l_first == NULL)
+#define LIST_FIRST(head) ((head)->l_first)
 #define LIST_FOREACH(var, head, field) \
   for ((var) = (head)->l_first; (var) != NULL; (var) = (var)->field.l_next)
 #define LIST_INIT(head)     \
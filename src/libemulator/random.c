@@ -5,10 +5,17 @@
 
 #include "config.h"
 
+#if CONFIG_HAS_GETRANDOM
+#include <sys/random.h>
+#endif
+
+#include <errno.h>
 #include <fcntl.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "random.h"
@@ -19,6 +26,27 @@ void random_buf(void *buf, size_t len) {
   arc4random_buf(buf, len);
 }
 
+void random_postfork(void) {
+}
+
+#else
+
+#if CONFIG_HAS_GETRANDOM
+
+static void random_seed(void *buf, size_t len) {
+  while (len > 0) {
+    ssize_t ret = getrandom(buf, len, 0);
+    if (ret < 0) {
+      if (errno == EINTR)
+        continue;
+      fputs("Failed to call getrandom()\n", stderr);
+      abort();
+    }
+    buf = (char *)buf + ret;
+    len -= ret;
+  }
+}
+
 #else
 
 static int urandom;
@@ -31,7 +59,7 @@ static void open_urandom(void) {
   }
 }
 
-void random_buf(void *buf, size_t len) {
+static void random_seed(void *buf, size_t len) {
   static pthread_once_t open_once = PTHREAD_ONCE_INIT;
   pthread_once(&open_once, open_urandom);
 
@@ -43,6 +71,131 @@ void random_buf(void *buf, size_t len) {
 
 #endif
 
+// Random numbers are generated by a per-thread ChaCha20 keystream that
+// is seeded by the operating system, so that we don't need to invoke a
+// system call every time random data is requested.
+//
+// Every refill of the buffer replaces the key by the first bytes of
+// the keystream, and handed out bytes are cleared, meaning that earlier
+// output cannot be reconstructed from the state of the generator.
+
+#define RANDOM_BLOCKS 16         // Number of blocks per refill.
+#define RANDOM_RESEED (1 << 20)  // Number of bytes until reseeding.
+
+struct random_state {
+  uint32_t key[8];                        // Current ChaCha20 key.
+  unsigned char buf[64 * RANDOM_BLOCKS];  // Buffered keystream.
+  size_t avail;                           // Unused bytes at end of buf.
+  size_t remaining;                       // Bytes until reseeding.
+  unsigned int generation;                // Fork generation of the seed.
+};
+
+static _Thread_local struct random_state random_state;
+
+// Incremented after forking, to force threads to reseed. Starts at one,
+// so that the state of new threads is seeded as well.
+static _Atomic(unsigned int) random_generation = 1;
+
+static uint32_t random_load32(const unsigned char *buf) {
+  return (uint32_t)buf[0] | (uint32_t)buf[1] << 8 | (uint32_t)buf[2] << 16 |
+         (uint32_t)buf[3] << 24;
+}
+
+static void random_store32(unsigned char *buf, uint32_t v) {
+  buf[0] = v;
+  buf[1] = v >> 8;
+  buf[2] = v >> 16;
+  buf[3] = v >> 24;
+}
+
+#define ROTL32(v, n) ((v) << (n) | (v) >> (32 - (n)))
+#define QUARTERROUND(a, b, c, d) \
+  do {                           \
+    a += b;                      \
+    d = ROTL32(d ^ a, 16);       \
+    c += d;                      \
+    b = ROTL32(b ^ c, 12);       \
+    a += b;                      \
+    d = ROTL32(d ^ a, 8);        \
+    c += d;                      \
+    b = ROTL32(b ^ c, 7);        \
+  } while (0)
+
+// Computes a single 64-byte block of the ChaCha20 keystream.
+static void random_chacha20_block(const uint32_t *key, uint32_t counter,
+                                  unsigned char *out) {
+  uint32_t in[16] = {
+      0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+      key[0],     key[1],     key[2],     key[3],
+      key[4],     key[5],     key[6],     key[7],
+      counter,    0,          0,          0,
+  };
+  uint32_t x[16];
+  memcpy(x, in, sizeof(x));
+  for (int i = 0; i < 10; ++i) {
+    QUARTERROUND(x[0], x[4], x[8], x[12]);
+    QUARTERROUND(x[1], x[5], x[9], x[13]);
+    QUARTERROUND(x[2], x[6], x[10], x[14]);
+    QUARTERROUND(x[3], x[7], x[11], x[15]);
+    QUARTERROUND(x[0], x[5], x[10], x[15]);
+    QUARTERROUND(x[1], x[6], x[11], x[12]);
+    QUARTERROUND(x[2], x[7], x[8], x[13]);
+    QUARTERROUND(x[3], x[4], x[9], x[14]);
+  }
+  for (int i = 0; i < 16; ++i)
+    random_store32(out + i * 4, x[i] + in[i]);
+}
+
+#undef QUARTERROUND
+#undef ROTL32
+
+// Refills the keystream buffer, reseeding the generator if needed.
+static void random_refill(struct random_state *rs) {
+  unsigned int generation =
+      atomic_load_explicit(&random_generation, memory_order_relaxed);
+  if (rs->generation != generation || rs->remaining == 0) {
+    random_seed(rs->key, sizeof(rs->key));
+    rs->remaining = RANDOM_RESEED;
+    rs->generation = generation;
+  }
+
+  // Generate new keystream and use the start of it as the next key.
+  for (uint32_t i = 0; i < RANDOM_BLOCKS; ++i)
+    random_chacha20_block(rs->key, i, rs->buf + i * 64);
+  for (size_t i = 0; i < 8; ++i)
+    rs->key[i] = random_load32(rs->buf + i * 4);
+  memset(rs->buf, 0, sizeof(rs->key));
+  rs->avail = sizeof(rs->buf) - sizeof(rs->key);
+  rs->remaining = rs->remaining > rs->avail ? rs->remaining - rs->avail : 0;
+}
+
+void random_buf(void *buf, size_t len) {
+  struct random_state *rs = &random_state;
+
+  // Discard any keystream inherited from the parent process.
+  if (rs->generation !=
+      atomic_load_explicit(&random_generation, memory_order_relaxed))
+    rs->avail = 0;
+
+  while (len > 0) {
+    if (rs->avail == 0)
+      random_refill(rs);
+    size_t chunk = len < rs->avail ? len : rs->avail;
+    unsigned char *keystream = rs->buf + sizeof(rs->buf) - rs->avail;
+    memcpy(buf, keystream, chunk);
+    memset(keystream, 0, chunk);
+    buf = (char *)buf + chunk;
+    len -= chunk;
+    rs->avail -= chunk;
+  }
+}
+
+void random_postfork(void) {
+  atomic_fetch_add_explicit(&random_generation, 1, memory_order_relaxed);
+}
+
+#endif
+
 // Calculates a random number within the range [0, upper - 1] without
 // any modulo bias.
 //
@@ -6,9 +6,13 @@
 #ifndef RANDOM_H
 #define RANDOM_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 void random_buf(void *, size_t);
 uintmax_t random_uniform(uintmax_t);
 
+// Should be invoked after forking, to reseed the generator.
+void random_postfork(void);
+
 #endif
@@ -30,6 +30,19 @@ static inline void refcount_acquire(struct refcount *r) PRODUCES(*r) {
   atomic_fetch_add_explicit(&r->count, 1, memory_order_acquire);
 }
 
+// Increment the reference counter, unless it has already dropped to
+// zero. Returns whether a reference was acquired.
+static inline bool refcount_acquire_if_not_zero(struct refcount *r)
+    TRYLOCKS_SHARED(true, *r) NO_LOCK_ANALYSIS {
+  unsigned int old = atomic_load_explicit(&r->count, memory_order_relaxed);
+  do {
+    if (old == 0)
+      return false;
+  } while (!atomic_compare_exchange_weak_explicit(
+      &r->count, &old, old + 1, memory_order_acquire, memory_order_relaxed));
+  return true;
+}
+
 // Decrement the reference counter, returning whether the reference
 // dropped to zero.
 static inline bool refcount_release(struct refcount *r) CONSUMES(*r) {
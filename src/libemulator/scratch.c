@@ -0,0 +1,97 @@
+// Copyright (c) 2016 Nuxi, https://nuxi.nl/
+//
+// This file is distributed under a 2-clause BSD license.
+// See the LICENSE file for details.
+
+#include <errno.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "scratch.h"
+
+// Minimum size of a chunk. Large enough to hold a couple of pathnames.
+#define SCRATCH_CHUNK_SIZE 16384
+
+struct scratch_chunk {
+  struct scratch_chunk *sc_next;  // Next chunk in the arena.
+  size_t sc_size;                 // Number of bytes of storage.
+  max_align_t sc_data[];          // Storage.
+};
+
+// Arena of the current thread. Chunks following the chunk in use are
+// kept around for reuse.
+static _Thread_local struct scratch_chunk *scratch_first;
+static _Thread_local struct scratch_mark scratch_position;
+
+static _Atomic(uint64_t) scratch_allocations;
+
+struct scratch_mark scratch_mark(void) {
+  return scratch_position;
+}
+
+void scratch_release(const struct scratch_mark *sm) {
+  if (sm->base + sm->used < scratch_position.base + scratch_position.used)
+    scratch_position = *sm;
+}
+
+void *scratch_alloc(size_t len) {
+  struct scratch_mark *sp = &scratch_position;
+  len = (len + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+  struct scratch_chunk *sc = sp->chunk;
+  if (sc != NULL && sc->sc_size - sp->used >= len) {
+    void *ret = (char *)sc->sc_data + sp->used;
+    sp->used += len;
+    return ret;
+  }
+
+  // Move on to the next chunk, inserting a new one if it is missing or
+  // too small to fit the allocation.
+  struct scratch_chunk **next = sc == NULL ? &scratch_first : &sc->sc_next;
+  if (*next == NULL || (*next)->sc_size < len) {
+    size_t size = len < SCRATCH_CHUNK_SIZE ? SCRATCH_CHUNK_SIZE : len;
+    struct scratch_chunk *nsc = malloc(sizeof(*nsc) + size);
+    if (nsc == NULL)
+      return NULL;
+    atomic_fetch_add_explicit(&scratch_allocations, 1, memory_order_relaxed);
+    nsc->sc_next = *next;
+    nsc->sc_size = size;
+    *next = nsc;
+  }
+  if (sc != NULL)
+    sp->base += sc->sc_size;
+  sp->chunk = *next;
+  sp->used = len;
+  return sp->chunk->sc_data;
+}
+
+char *scratch_nullterminate(const char *s, size_t len) {
+  // Ensure that the string contains no null bytes within.
+  if (memchr(s, '\0', len) != NULL) {
+    errno = EILSEQ;
+    return NULL;
+  }
+
+  char *ret = scratch_alloc(len + 1);
+  if (ret == NULL)
+    return NULL;
+  memcpy(ret, s, len);
+  ret[len] = '\0';
+  return ret;
+}
+
+uint64_t scratch_chunks_allocated(void) {
+  return atomic_load_explicit(&scratch_allocations, memory_order_relaxed);
+}
+
+void scratch_thread_exit(void) {
+  struct scratch_chunk *sc = scratch_first;
+  while (sc != NULL) {
+    struct scratch_chunk *next = sc->sc_next;
+    free(sc);
+    sc = next;
+  }
+  scratch_first = NULL;
+  scratch_position = (struct scratch_mark){0};
+}
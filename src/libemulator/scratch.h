@@ -0,0 +1,47 @@
+// Copyright (c) 2016 Nuxi, https://nuxi.nl/
+//
+// This file is distributed under a 2-clause BSD license.
+// See the LICENSE file for details.
+
+#ifndef SCRATCH_H
+#define SCRATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Per-thread arena for temporary allocations made while processing a
+// system call, such as pathname strings. Allocations are not freed
+// individually. Instead, the arena is rewound to a mark obtained
+// earlier. Memory is retained by the arena, so that system calls
+// don't need to call into malloc() in the common case.
+
+struct scratch_chunk;
+
+struct scratch_mark {
+  struct scratch_chunk *chunk;  // Chunk in use.
+  size_t base;                  // Offset of the chunk within the arena.
+  size_t used;                  // Bytes in use within the chunk.
+};
+
+// Returns the current position of the arena.
+struct scratch_mark scratch_mark(void);
+
+// Rewinds the arena, freeing all allocations made after obtaining the
+// mark. Rewinding to a mark that lies beyond the current position of
+// the arena is a no-op.
+void scratch_release(const struct scratch_mark *);
+
+// Allocates memory from the arena.
+void *scratch_alloc(size_t);
+
+// Copies a string into the arena, null terminating it. Fails with
+// EILSEQ if the string contains null bytes.
+char *scratch_nullterminate(const char *, size_t);
+
+// Returns the number of chunks allocated by all arenas.
+uint64_t scratch_chunks_allocated(void);
+
+// Should be invoked by threads before they terminate.
+void scratch_thread_exit(void);
+
+#endif
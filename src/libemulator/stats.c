@@ -0,0 +1,270 @@
+// Copyright (c) 2016 Nuxi, https://nuxi.nl/
+//
+// This file is distributed under a 2-clause BSD license.
+// See the LICENSE file for details.
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cloudabi_syscalls_info.h>
+#include <cloudabi_syscalls_struct.h>
+
+#include "stats.h"
+
+// Indices of the system calls.
+enum {
+#define entry(name) STATS_##name,
+  CLOUDABI_SYSCALL_NAMES(entry)
+#undef entry
+  STATS_NSYSCALLS
+};
+
+static const char *const stats_names[STATS_NSYSCALLS] = {
+#define entry(name) #name,
+    CLOUDABI_SYSCALL_NAMES(entry)
+#undef entry
+};
+
+// Latencies are recorded in buckets. Bucket n holds latencies of at
+// least 2^n nanoseconds, but less than 2^(n+1) nanoseconds.
+#define STATS_NBUCKETS 32
+
+// Statistics of a single system call.
+struct stats_syscall {
+  _Atomic(uint64_t) calls;     // Number of calls.
+  _Atomic(uint64_t) errors;    // Number of calls that failed.
+  _Atomic(uint64_t) total_ns;  // Time spent in the system call.
+  _Atomic(uint64_t) latency[STATS_NBUCKETS];  // Latency histogram.
+};
+
+// Per-thread statistics. Counters are only written by the thread owning
+// the record, so that recording requires no atomic read-modify-write
+// operations or writes to shared cache lines. Records are never freed,
+// but are recycled once the thread owning them has terminated.
+struct stats_record {
+  alignas(64) struct stats_syscall syscalls[STATS_NSYSCALLS];
+  _Atomic(bool) used;         // Owned by a thread.
+  struct stats_record *next;  // Next record in the list.
+};
+
+// List of all records. Records are only ever prepended.
+static _Atomic(struct stats_record *) stats_records = NULL;
+static _Thread_local struct stats_record *stats_self = NULL;
+
+static const cloudabi_syscalls_t *stats_forward;
+static FILE *stats_out;
+static bool stats_json;
+static pid_t stats_pid;
+
+void stats_init(const cloudabi_syscalls_t *forward, FILE *out, bool json) {
+  stats_forward = forward;
+  stats_out = out;
+  stats_json = json;
+  stats_pid = getpid();
+}
+
+// Returns the record of the calling thread, allocating one if needed.
+static struct stats_record *stats_record_get(void) {
+  struct stats_record *sr = stats_self;
+  if (sr != NULL)
+    return sr;
+
+  // Recycle a record of a thread that has terminated.
+  for (sr = atomic_load_explicit(&stats_records, memory_order_acquire);
+       sr != NULL; sr = sr->next) {
+    bool used = false;
+    if (!atomic_load_explicit(&sr->used, memory_order_relaxed) &&
+        atomic_compare_exchange_strong_explicit(&sr->used, &used, true,
+                                                memory_order_acquire,
+                                                memory_order_relaxed)) {
+      stats_self = sr;
+      return sr;
+    }
+  }
+
+  // Allocate a new record and prepend it to the list.
+  void *p;
+  if (posix_memalign(&p, alignof(struct stats_record), sizeof(*sr)) != 0)
+    return NULL;
+  sr = p;
+  for (size_t i = 0; i < STATS_NSYSCALLS; ++i) {
+    struct stats_syscall *ss = &sr->syscalls[i];
+    atomic_init(&ss->calls, 0);
+    atomic_init(&ss->errors, 0);
+    atomic_init(&ss->total_ns, 0);
+    for (size_t j = 0; j < STATS_NBUCKETS; ++j)
+      atomic_init(&ss->latency[j], 0);
+  }
+  atomic_init(&sr->used, true);
+  sr->next = atomic_load_explicit(&stats_records, memory_order_relaxed);
+  while (!atomic_compare_exchange_weak_explicit(&stats_records, &sr->next, sr,
+                                                memory_order_release,
+                                                memory_order_relaxed))
+    ;
+  stats_self = sr;
+  return sr;
+}
+
+// Adds a value to a counter owned by the calling thread.
+static void stats_add(_Atomic(uint64_t) *counter, uint64_t value) {
+  atomic_store_explicit(
+      counter, atomic_load_explicit(counter, memory_order_relaxed) + value,
+      memory_order_relaxed);
+}
+
+// Records a call to a system call that has returned.
+static void stats_record(size_t index, const struct timespec *start,
+                         bool failed) {
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  struct stats_record *sr = stats_record_get();
+  if (sr == NULL)
+    return;
+
+  uint64_t ns = (uint64_t)(end.tv_sec - start->tv_sec) * 1000000000 +
+                end.tv_nsec - start->tv_nsec;
+  size_t bucket = ns == 0 ? 0 : 63 - __builtin_clzll(ns);
+  if (bucket >= STATS_NBUCKETS)
+    bucket = STATS_NBUCKETS - 1;
+  struct stats_syscall *ss = &sr->syscalls[index];
+  stats_add(&ss->calls, 1);
+  if (failed)
+    stats_add(&ss->errors, 1);
+  stats_add(&ss->total_ns, ns);
+  stats_add(&ss->latency[bucket], 1);
+}
+
+// Returns the upper bound of the bucket containing a percentile.
+static uint64_t stats_percentile(const uint64_t *latency, uint64_t calls,
+                                 unsigned int percentile) {
+  uint64_t seen = 0;
+  for (size_t i = 0; i < STATS_NBUCKETS; ++i) {
+    seen += latency[i];
+    if (seen * 100 >= calls * percentile)
+      return UINT64_C(2) << i;
+  }
+  return UINT64_MAX;
+}
+
+// Sums up the records of all threads and writes the results.
+static void stats_write(void) {
+  static struct {
+    uint64_t calls;
+    uint64_t errors;
+    uint64_t total_ns;
+    uint64_t latency[STATS_NBUCKETS];
+  } totals[STATS_NSYSCALLS];
+  for (struct stats_record *sr =
+           atomic_load_explicit(&stats_records, memory_order_acquire);
+       sr != NULL; sr = sr->next) {
+    for (size_t i = 0; i < STATS_NSYSCALLS; ++i) {
+      struct stats_syscall *ss = &sr->syscalls[i];
+      totals[i].calls += atomic_load_explicit(&ss->calls, memory_order_relaxed);
+      totals[i].errors +=
+          atomic_load_explicit(&ss->errors, memory_order_relaxed);
+      totals[i].total_ns +=
+          atomic_load_explicit(&ss->total_ns, memory_order_relaxed);
+      for (size_t j = 0; j < STATS_NBUCKETS; ++j)
+        totals[i].latency[j] +=
+            atomic_load_explicit(&ss->latency[j], memory_order_relaxed);
+    }
+  }
+
+  if (stats_json) {
+    fputs("{\"syscalls\":{", stats_out);
+    const char *separator = "";
+    for (size_t i = 0; i < STATS_NSYSCALLS; ++i) {
+      if (totals[i].calls == 0)
+        continue;
+      fprintf(stats_out,
+              "%s\"%s\":{\"calls\":%ju,\"errors\":%ju,\"total_ns\":%ju,"
+              "\"latency_ns\":{",
+              separator, stats_names[i], (uintmax_t)totals[i].calls,
+              (uintmax_t)totals[i].errors, (uintmax_t)totals[i].total_ns);
+      const char *bucket_separator = "";
+      for (size_t j = 0; j < STATS_NBUCKETS; ++j) {
+        if (totals[i].latency[j] > 0) {
+          fprintf(stats_out, "%s\"%ju\":%ju", bucket_separator,
+                  (uintmax_t)(j == 0 ? 0 : UINT64_C(1) << j),
+                  (uintmax_t)totals[i].latency[j]);
+          bucket_separator = ",";
+        }
+      }
+      fputs("}}", stats_out);
+      separator = ",";
+    }
+    fputs("}}\n", stats_out);
+  } else {
+    fprintf(stats_out, "%-16s %12s %10s %12s %10s %10s %10s\n", "syscall",
+            "calls", "errors", "total ms", "mean ns", "p50 ns", "p99 ns");
+    for (size_t i = 0; i < STATS_NSYSCALLS; ++i) {
+      if (totals[i].calls == 0)
+        continue;
+      // Calls that don't return only have their call count recorded.
+      uint64_t returned = 0;
+      for (size_t j = 0; j < STATS_NBUCKETS; ++j)
+        returned += totals[i].latency[j];
+      if (returned == 0) {
+        fprintf(stats_out, "%-16s %12ju\n", stats_names[i],
+                (uintmax_t)totals[i].calls);
+        continue;
+      }
+      fprintf(stats_out, "%-16s %12ju %10ju %12.3f %10ju %10ju %10ju\n",
+              stats_names[i], (uintmax_t)totals[i].calls,
+              (uintmax_t)totals[i].errors, totals[i].total_ns / 1e6,
+              (uintmax_t)(totals[i].total_ns / returned),
+              (uintmax_t)stats_percentile(totals[i].latency, returned, 50),
+              (uintmax_t)stats_percentile(totals[i].latency, returned, 99));
+    }
+  }
+  fflush(stats_out);
+}
+
+// Records a call to a system call that does not return.
+static void stats_noreturn(size_t index) {
+  struct stats_record *sr = stats_record_get();
+  if (sr != NULL)
+    stats_add(&sr->syscalls[index].calls, 1);
+
+  if (index == STATS_proc_exit) {
+    // Only write statistics for the process that enabled them, not for
+    // any children it has forked.
+    if (stats_out != NULL && getpid() == stats_pid)
+      stats_write();
+  } else if (index == STATS_thread_exit && sr != NULL) {
+    // Allow the record to be recycled by another thread.
+    stats_self = NULL;
+    atomic_store_explicit(&sr->used, false, memory_order_release);
+  }
+}
+
+// Generates wrappers for every system call in the system call table,
+// measuring the time spent in the system call it forwards to.
+#define wrapper(name)                                                       \
+  static CLOUDABI_SYSCALL_RETURNS_##name(cloudabi_errno_t, void)            \
+      name(CLOUDABI_SYSCALL_HAS_PARAMETERS_##name(                          \
+          CLOUDABI_SYSCALL_PARAMETERS_##name, void)) {                      \
+    CLOUDABI_SYSCALL_RETURNS_##name(, stats_noreturn(STATS_##name);)        \
+    struct timespec start;                                                  \
+    clock_gettime(CLOCK_MONOTONIC, &start);                                 \
+    CLOUDABI_SYSCALL_RETURNS_##name(cloudabi_errno_t error =, )             \
+        stats_forward->name(CLOUDABI_SYSCALL_PARAMETER_NAMES_##name);       \
+    stats_record(STATS_##name, &start,                                      \
+                 CLOUDABI_SYSCALL_RETURNS_##name(error != 0, false));       \
+    CLOUDABI_SYSCALL_RETURNS_##name(return error;, )                        \
+  }
+CLOUDABI_SYSCALL_NAMES(wrapper)
+#undef wrapper
+
+cloudabi_syscalls_t stats_syscalls = {
+#define entry(name) .name = name,
+    CLOUDABI_SYSCALL_NAMES(entry)
+#undef entry
+};
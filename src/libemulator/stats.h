@@ -0,0 +1,26 @@
+// Copyright (c) 2016 Nuxi, https://nuxi.nl/
+//
+// This file is distributed under a 2-clause BSD license.
+// See the LICENSE file for details.
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include <cloudabi_syscalls_struct.h>
+
+// System call table that records call counts, error counts and latency
+// histograms for every system call, forwarding calls to an alternative
+// system call table. The statistics are written when the process
+// terminates through proc_exit().
+extern cloudabi_syscalls_t stats_syscalls;
+
+// Sets the system call table to which stats_syscalls forwards calls,
+// and the stream to which statistics are written, either in a
+// human-readable form or as JSON. If no stream is provided, statistics
+// are only collected.
+void stats_init(const cloudabi_syscalls_t *, FILE *, bool);
+
+#endif
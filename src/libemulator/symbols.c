@@ -0,0 +1,122 @@
+// Copyright (c) 2016 Nuxi, https://nuxi.nl/
+//
+// This file is distributed under a 2-clause BSD license.
+// See the LICENSE file for details.
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "elf.h"
+#include "symbols.h"
+
+// Reads a part of the executable. As executables are regular files,
+// short reads only occur if the executable is truncated.
+static bool symbols_pread(int fd, void *buf, size_t len, off_t pos) {
+  ssize_t retval = pread(fd, buf, len, pos);
+  if (retval < 0)
+    return false;
+  if ((size_t)retval != len) {
+    errno = ENOEXEC;
+    return false;
+  }
+  return true;
+}
+
+static int symbols_compare(const void *a, const void *b) {
+  const struct symbol *sa = a, *sb = b;
+  return sa->start < sb->start ? -1 : sa->start > sb->start;
+}
+
+bool symbols_load(struct symbols *symbols, int fd, const ElfW(Ehdr) * ehdr,
+                  const char *base) {
+  symbols->entries = NULL;
+  symbols->count = 0;
+  symbols->strings = NULL;
+  if (ehdr->e_shoff == 0 || ehdr->e_shnum == 0 ||
+      ehdr->e_shentsize != sizeof(ElfW(Shdr)))
+    return true;
+
+  // Find the symbol table and its string table.
+  ElfW(Shdr) *shdrs = malloc(sizeof(*shdrs) * ehdr->e_shnum);
+  if (shdrs == NULL)
+    return false;
+  if (!symbols_pread(fd, shdrs, sizeof(*shdrs) * ehdr->e_shnum,
+                     ehdr->e_shoff)) {
+    free(shdrs);
+    return false;
+  }
+  const ElfW(Shdr) *symtab = NULL;
+  for (size_t i = 0; i < ehdr->e_shnum; ++i) {
+    if (shdrs[i].sh_type == SHT_SYMTAB ||
+        (shdrs[i].sh_type == SHT_DYNSYM && symtab == NULL))
+      symtab = &shdrs[i];
+  }
+  if (symtab == NULL || symtab->sh_link >= ehdr->e_shnum ||
+      symtab->sh_entsize != sizeof(ElfW(Sym))) {
+    free(shdrs);
+    return true;
+  }
+  const ElfW(Shdr) *strtab = &shdrs[symtab->sh_link];
+
+  // Copy in the symbol and string tables. Add a trailing null byte to
+  // the string table, so that names can never run past its end.
+  size_t nsyms = symtab->sh_size / sizeof(ElfW(Sym));
+  ElfW(Sym) *syms = malloc(symtab->sh_size);
+  symbols->strings = malloc(strtab->sh_size + 1);
+  symbols->entries = malloc(sizeof(struct symbol) * nsyms);
+  if (syms == NULL || symbols->strings == NULL || symbols->entries == NULL ||
+      !symbols_pread(fd, syms, symtab->sh_size, symtab->sh_offset) ||
+      !symbols_pread(fd, symbols->strings, strtab->sh_size,
+                     strtab->sh_offset)) {
+    free(shdrs);
+    free(syms);
+    symbols_destroy(symbols);
+    return false;
+  }
+  symbols->strings[strtab->sh_size] = '\0';
+
+  // Extract all functions defined by the executable.
+  for (size_t i = 0; i < nsyms; ++i) {
+    const ElfW(Sym) *sym = &syms[i];
+    if (ELFW(ST_TYPE)(sym->st_info) == STT_FUNC &&
+        sym->st_shndx != SHN_UNDEF && sym->st_size > 0 &&
+        sym->st_name < strtab->sh_size) {
+      symbols->entries[symbols->count++] = (struct symbol){
+          .start = (uintptr_t)(base + sym->st_value),
+          .size = sym->st_size,
+          .name = symbols->strings + sym->st_name,
+      };
+    }
+  }
+  qsort(symbols->entries, symbols->count, sizeof(struct symbol),
+        symbols_compare);
+  free(shdrs);
+  free(syms);
+  return true;
+}
+
+const struct symbol *symbols_lookup(const struct symbols *symbols,
+                                    uintptr_t address) {
+  // Find the last symbol starting at or before the address.
+  size_t min = 0, max = symbols->count;
+  while (min < max) {
+    size_t mid = min + (max - min) / 2;
+    if (symbols->entries[mid].start <= address)
+      min = mid + 1;
+    else
+      max = mid;
+  }
+  if (min == 0)
+    return NULL;
+  const struct symbol *symbol = &symbols->entries[min - 1];
+  return address - symbol->start < symbol->size ? symbol : NULL;
+}
+
+void symbols_destroy(struct symbols *symbols) {
+  free(symbols->entries);
+  free(symbols->strings);
+}
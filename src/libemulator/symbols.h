@@ -0,0 +1,39 @@
+// Copyright (c) 2016 Nuxi, https://nuxi.nl/
+//
+// This file is distributed under a 2-clause BSD license.
+// See the LICENSE file for details.
+
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "elf.h"
+
+// Function symbols of an executable that has been loaded into memory.
+struct symbol {
+  uintptr_t start;   // Address of the function.
+  size_t size;       // Size of the function.
+  const char *name;  // Name of the function.
+};
+
+struct symbols {
+  struct symbol *entries;  // Symbols, sorted by address.
+  size_t count;            // Number of symbols.
+  char *strings;           // Storage of the names.
+};
+
+// Reads the function symbols of an executable loaded at a base
+// address. Symbols are read from the symbol table, falling back to the
+// dynamic symbol table for stripped executables. Executables without
+// any symbols yield an empty set of symbols.
+bool symbols_load(struct symbols *, int, const ElfW(Ehdr) *, const char *);
+
+// Returns the function containing an address, if any.
+const struct symbol *symbols_lookup(const struct symbols *, uintptr_t);
+
+void symbols_destroy(struct symbols *);
+
+#endif
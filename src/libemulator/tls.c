@@ -6,13 +6,89 @@
 #include "config.h"
 
 #include <signal.h>
+#include <stdalign.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
 
 #include <cloudabi_syscalls_info.h>
 #include <cloudabi_syscalls_struct.h>
 
 #include "tls.h"
 
+// TLS bookkeeping of the current thread, accessible while running on
+// the TLS area of the host.
+static _Thread_local struct tls *tls_self;
+
+// Number of system calls made by a thread. Counters are only written by
+// the thread owning them, so that counting requires no atomic
+// read-modify-write operations or writes to shared cache lines.
+// Counters are never freed, but are recycled once the thread owning
+// them has terminated, retaining their value.
+struct tls_counter {
+  alignas(64) _Atomic(uint64_t) calls;
+  _Atomic(bool) used;        // Owned by a thread.
+  struct tls_counter *next;  // Next counter in the list.
+};
+
+// List of all counters. Counters are only ever prepended.
+static _Atomic(struct tls_counter *) tls_counters = NULL;
+
+// Returns an unused counter, allocating one if needed.
+static struct tls_counter *tls_counter_get(void) {
+  struct tls_counter *tc;
+  for (tc = atomic_load_explicit(&tls_counters, memory_order_acquire);
+       tc != NULL; tc = tc->next) {
+    bool used = false;
+    if (!atomic_load_explicit(&tc->used, memory_order_relaxed) &&
+        atomic_compare_exchange_strong_explicit(&tc->used, &used, true,
+                                                memory_order_acquire,
+                                                memory_order_relaxed))
+      return tc;
+  }
+
+  void *p;
+  if (posix_memalign(&p, alignof(struct tls_counter), sizeof(*tc)) != 0)
+    return NULL;
+  tc = p;
+  atomic_init(&tc->calls, 0);
+  atomic_init(&tc->used, true);
+  tc->next = atomic_load_explicit(&tls_counters, memory_order_relaxed);
+  while (!atomic_compare_exchange_weak_explicit(&tls_counters, &tc->next, tc,
+                                                memory_order_release,
+                                                memory_order_relaxed))
+    ;
+  return tc;
+}
+
+// Counts a system call made by the thread owning the bookkeeping.
+static void tls_count(struct tls *tls) {
+  struct tls_counter *tc = tls->counter;
+  if (tc != NULL)
+    atomic_store_explicit(
+        &tc->calls, atomic_load_explicit(&tc->calls, memory_order_relaxed) + 1,
+        memory_order_relaxed);
+}
+
+// Allows the counter of a terminating thread to be recycled.
+static void tls_counter_put(struct tls *tls) {
+  struct tls_counter *tc = tls->counter;
+  if (tc != NULL) {
+    tls->counter = NULL;
+    atomic_store_explicit(&tc->used, false, memory_order_release);
+  }
+}
+
+uint64_t tls_calls_get(void) {
+  uint64_t calls = 0;
+  for (struct tls_counter *tc =
+           atomic_load_explicit(&tls_counters, memory_order_acquire);
+       tc != NULL; tc = tc->next)
+    calls += atomic_load_explicit(&tc->calls, memory_order_relaxed);
+  return calls;
+}
+
 #if defined(__aarch64__)
 
 static void *tls_get(void) {
@@ -97,9 +173,15 @@ void tls_init(struct tls *tls, const cloudabi_syscalls_t *forward) {
   tls->tcb.parent = tls;
   tls->tls_host = tls_get();
   tls->forward = forward;
+  tls->counter = tls_counter_get();
+  tls_self = tls;
   tls_set(&tls->tcb);
 }
 
+const cloudabi_syscalls_t *tls_forward_get(void) {
+  return tls_self->forward;
+}
+
 // Generates wrappers for every system call in the system call table,
 // preserving and restoring TLS accordingly.
 #define wrapper(name)                                                  \
@@ -110,6 +192,8 @@ void tls_init(struct tls *tls, const cloudabi_syscalls_t *forward) {
     const cloudabi_tcb_t *tls_guest = tls_get();                       \
     struct tls *tls = tls_guest->parent;                               \
     tls_set(tls->tls_host);                                            \
+    tls_count(tls);                                                    \
+    CLOUDABI_SYSCALL_RETURNS_##name(, tls_counter_put(tls);)           \
                                                                        \
     CLOUDABI_SYSCALL_RETURNS_##name(cloudabi_errno_t error =, )        \
         tls->forward->name(CLOUDABI_SYSCALL_PARAMETER_NAMES_##name);   \
@@ -128,3 +212,11 @@ cloudabi_syscalls_t tls_syscalls = {
     CLOUDABI_SYSCALL_NAMES(entry)
 #undef entry
 };
+
+void tls_syscalls_get(cloudabi_syscalls_t *syscalls,
+                      const cloudabi_syscalls_t *forward) {
+  *syscalls = tls_syscalls;
+#define leaf(name) syscalls->name = forward->name;
+  TLS_SYSCALLS_LEAF(leaf)
+#undef leaf
+}
@@ -6,22 +6,46 @@
 #ifndef TLS_H
 #define TLS_H
 
+#include <stdint.h>
+
 #include <cloudabi_syscalls_struct.h>
 
+struct tls_counter;
+
 // Bookkeeping for properly supporting TLS in guests.
 struct tls {
   cloudabi_tcb_t tcb;  // Initial TLS area for new threads.
   void *tls_host;      // Backup of TLS area of the host while executing.
   const cloudabi_syscalls_t *forward;  // System calls to which to forward.
+  struct tls_counter *counter;         // Number of system calls made.
 };
 
 // System call table that properly switches TLS areas when entering and
 // leaving system calls. Calls get forwarded to an alternative system
-// call table.
+// call table. It also counts the number of calls made.
 extern cloudabi_syscalls_t tls_syscalls;
 
+// System calls that may be invoked without switching TLS areas, as they
+// are frequently called and only need to do little work. Their
+// implementations in the system call table to which calls get
+// forwarded may not access any thread-local variables, including errno.
+#define TLS_SYSCALLS_LEAF(leaf) \
+  leaf(clock_res_get) leaf(clock_time_get) leaf(thread_yield)
+
+// Fills a system call table with the entries of tls_syscalls, except
+// for leaf system calls, which are called directly.
+void tls_syscalls_get(cloudabi_syscalls_t *, const cloudabi_syscalls_t *);
+
 // Sets up TLS for a thread to point to an initial TLS area for a guest,
 // while preserving the TLS area of the host.
 void tls_init(struct tls *, const cloudabi_syscalls_t *);
 
+// Returns the system call table to which calls of the current thread
+// get forwarded, so that threads it creates can use the same table.
+const cloudabi_syscalls_t *tls_forward_get(void);
+
+// Returns the total number of system calls made through tls_syscalls by
+// all threads. Leaf system calls are not included.
+uint64_t tls_calls_get(void);
+
 #endif